@@ -31,6 +31,41 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+
+#ifndef JSWR_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#define JSWR_SIMD_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define JSWR_SIMD_AVX2
+#define JSWR_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(_MSC_VER)
+#define JSWR_SIMD_AVX2
+#define JSWR_TARGET_AVX2
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+#endif
+#endif
+
+#ifndef JSWR_NO_FD
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <errno.h>
+#endif
+#endif
+
+#ifdef JSWR_THREADS
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -42,6 +77,48 @@ extern "C" {
 #define JSWR_API extern
 #endif
 
+#ifdef _MSC_VER
+typedef unsigned __int64 jswr_u64;
+typedef __int64 jswr_i64;
+#define JSWR_U64_C(num) num##ui64
+#else
+typedef unsigned long long jswr_u64;
+typedef long long jswr_i64;
+#define JSWR_U64_C(num) num##ULL
+#endif
+
+#ifndef JSWR_STR_MINSIZE
+#define JSWR_STR_MINSIZE 64
+#endif
+
+#ifndef JSWR_TAPE_MINSIZE
+#define JSWR_TAPE_MINSIZE 256
+#endif
+
+#ifndef JSWR_TRIM_WINDOW
+#define JSWR_TRIM_WINDOW 16
+#endif
+
+#ifndef JSWR_ARENA_BLOCKSIZE
+#define JSWR_ARENA_BLOCKSIZE 65536
+#endif
+
+#ifndef JSWR_MAX_DEPTH
+#define JSWR_MAX_DEPTH 1024
+#endif
+
+#ifndef JSWR_CHUNK_SIZE
+#define JSWR_CHUNK_SIZE 65536
+#endif
+
+#ifndef JSWR_THREAD_MINSIZE
+#define JSWR_THREAD_MINSIZE 65536
+#endif
+
+#ifndef JSWR_CACHE_DEPTH
+#define JSWR_CACHE_DEPTH 16
+#endif
+
 typedef enum jswrtype {
     JSWR_TOKEN_NONE,
     JSWR_TOKEN_OBJOPEN,
@@ -57,7 +134,19 @@ typedef enum jswrtype {
     JSWR_TOKEN_TRUE,
     JSWR_TOKEN_FALSE,
     JSWR_TOKEN_RAW,
-    JSWR_TOKEN_NULL
+    JSWR_TOKEN_NULL,
+    JSWR_TOKEN_DOUBLE,
+    JSWR_TOKEN_INTARRAY,
+    JSWR_TOKEN_DOUBLEARRAY,
+    JSWR_TOKEN_BOOLARRAY,
+    JSWR_TOKEN_STRINGARRAY,
+    JSWR_TOKEN_FRAGMENT,
+    JSWR_TOKEN_CACHED,
+    JSWR_TOKEN_KEY,
+    JSWR_TOKEN_INT64,
+    JSWR_TOKEN_UINT64,
+    JSWR_TOKEN_KEYREF,
+    JSWR_TOKEN_STRUCT
 } jswrtype_t;
 
 typedef enum jswrleveltype {
@@ -77,31 +166,256 @@ enum jswr_errors
     JSWR_ERROR_INVALBRACKET,
     JSWR_ERROR_TOKENOUTSIDE,
     JSWR_ERROR_UNEXPECTEDEXTRA,
-    JSWR_ERROR_WRITEFAIL
+    JSWR_ERROR_WRITEFAIL,
+    JSWR_ERROR_BADUTF8,
+    JSWR_ERROR_NONFINITE,
+    JSWR_ERROR_TOODEEP,
+    JSWR_ERROR_BADRAW,
+    JSWR_ERROR_BADKEY,
+    JSWR_ERROR_TOOLARGE
+};
+
+enum jswr_escapes
+{
+    JSWR_ESCAPE_DEFAULT=0,
+    JSWR_ESCAPE_SLASH=1,
+    JSWR_ESCAPE_UNICODE=2
+};
+
+enum jswr_utf8modes
+{
+    JSWR_UTF8_NONE,
+    JSWR_UTF8_REPLACE,
+    JSWR_UTF8_REJECT
+};
+
+enum jswr_nonfinites
+{
+    JSWR_NONFINITE_NULL,
+    JSWR_NONFINITE_STRING,
+    JSWR_NONFINITE_ERROR
 };
 
 typedef struct jswrtok
 {
     jswrtype_t tok_type;
     //
-    unsigned char * str;
+    const unsigned char * str;
     unsigned int str_size;
     int num_int;
-    float num_float;
+    double num_double;
+    jswr_u64 num_long; //64-bit ints, kept as their bits.
 	unsigned int beauty_break;
 } jswrtok_t;
 
+typedef struct jswrblock
+{
+    struct jswrblock * next;
+    unsigned int size;
+    unsigned int cap;
+} jswrblock_t;
+
+typedef struct jswrstate
+{
+    unsigned char level_bits[(JSWR_MAX_DEPTH+7)/8]; //One bit per level, set for arrays.
+    int level;
+    int prev_type;
+    unsigned int pos;
+    unsigned char prev_key;
+    unsigned char prev_break;
+    unsigned char need_comma;
+    unsigned char is_end;
+    unsigned char checked;
+    unsigned char compact;
+} jswrstate_t;
+
+typedef unsigned int (*jswrsink_fn)(void * userdata, const char * data, unsigned int size);
+
+typedef unsigned int (*jswrscan_fn)(const unsigned char * str, const unsigned int size, const unsigned int stop);
+
+typedef struct jswrcachestyle
+{
+    unsigned int indentwidth;
+    unsigned char indentspaces;
+    unsigned int compact;
+    unsigned char escape;
+    unsigned char utf8;
+    unsigned char nonfinite;
+    unsigned char rawcheck;
+} jswrcachestyle_t;
+
+typedef struct jswrcacheentry
+{
+    struct jswrcacheentry * next; //In its hash bucket.
+    struct jswrcacheentry * newer;
+    struct jswrcacheentry * older;
+    unsigned long hash;
+    unsigned char * key;
+    unsigned int key_size;
+    char * str[2]; //Written without [0] and with [1] Beautify.
+    unsigned int str_size[2];
+    unsigned char first_break[2]; //The beautify breaks its first and last commands had, which spill over onto what's around it.
+    unsigned char last_break[2];
+    jswrcachestyle_t style[2];
+} jswrcacheentry_t;
+
+typedef struct jswr_cache
+{
+    jswrcacheentry_t ** buckets;
+    unsigned int bucket_count;
+    unsigned int entry_count;
+    jswrcacheentry_t * newest;
+    jswrcacheentry_t * oldest;
+    unsigned int size;
+    unsigned int max_size;
+    unsigned int hits;
+    unsigned int misses;
+#ifdef JSWR_THREADS
+#ifdef _WIN32
+    CRITICAL_SECTION lock;
+#else
+    pthread_mutex_t lock;
+#endif
+#endif
+} jswrcache_t;
+
+typedef struct jswrkey
+{
+    unsigned int raw_start;
+    unsigned int raw_size;
+    unsigned int esc_start; //Quoted and escaped, with the ": " after it.
+    unsigned int esc_size;
+} jswrkey_t;
+
+typedef struct jswr_keys
+{
+    char * str;
+    unsigned int str_size;
+    unsigned int str_cap;
+    jswrkey_t * keys;
+    unsigned int key_count;
+    unsigned int key_cap;
+} jswrkeys_t;
+
+enum jswr_fields
+{
+    JSWR_FIELD_INT, //int
+    JSWR_FIELD_UINT, //unsigned int
+    JSWR_FIELD_INT64, //jswr_i64
+    JSWR_FIELD_UINT64, //jswr_u64
+    JSWR_FIELD_FLOAT, //float
+    JSWR_FIELD_DOUBLE, //double
+    JSWR_FIELD_BOOL, //int
+    JSWR_FIELD_STRING, //const char *, written as null when NULL
+    JSWR_FIELD_CHARS //char array
+};
+
+typedef struct jswrfield
+{
+    const char * key; //Quoted, with ": " after it.
+    unsigned int key_size;
+    unsigned char field_type;
+    unsigned int offset;
+    unsigned int size;
+} jswrfield_t;
+
+typedef struct jswrstruct
+{
+    const jswrfield_t * fields;
+    unsigned int field_count;
+    unsigned int struct_size;
+} jswrstruct_t;
+
+typedef struct jswrstructref
+{
+    const jswrstruct_t * desc;
+    const void * data;
+} jswrstructref_t;
+
+/*
+* Field list entries, for JSWR_STRUCT. Member names are plain identifiers, so their keys never need escaping, and are put together here.
+*/
+#define JSWR_FIELD(type, name, field_type) { "\"" #name "\": ", (unsigned int) sizeof(#name)+3, field_type, (unsigned int) offsetof(type, name), (unsigned int) sizeof(((type *) 0)->name) },
+
+/*
+* Defines the description desc_name for a struct type, from a field list macro taking (X, T) and giving X(T, member, JSWR_FIELD_*) for each member.
+*/
+#define JSWR_STRUCT(desc_name, type, fields) \
+    static const jswrfield_t desc_name##_fields[]={ fields(JSWR_FIELD, type) }; \
+    static const jswrstruct_t desc_name={ desc_name##_fields, (unsigned int) (sizeof(desc_name##_fields)/sizeof(desc_name##_fields[0])), (unsigned int) sizeof(type) }
+
+typedef struct jswrcacheopen
+{
+    const unsigned char * key;
+    unsigned int key_size;
+    unsigned int tape_start;
+    unsigned int size_start;
+    unsigned char site_break; //A break already pending at jswrwriter_cache_begin(), which belongs to where it's used rather than the value.
+    unsigned char value_break; //A break asked for after it, before the value's first command, which does belong to the value.
+} jswrcacheopen_t;
+
 typedef struct jswr_writer
 {
     unsigned int wr_size;
     int wr_level;
 	int wr_addbreak;
-    jswrtok_t * wr_token;
+    unsigned char * wr_tape;
+    unsigned int wr_tapesize;
+    unsigned int wr_tapecap;
+    jswrblock_t * wr_arena;
+    jswrblock_t * wr_arenacur;
+    unsigned char ** wr_frags;
+    unsigned int wr_fragcount;
+    unsigned int wr_fragcap;
     char * wr_str;
     unsigned int wr_strsize;
+    unsigned int wr_strcap;
+    unsigned char wr_measure; //Only counting what would be written, into wr_measured.
+    unsigned int wr_measured;
+    unsigned int setting_strinit;
+    unsigned char setting_keepbuffer;
+    unsigned int setting_trimsize;
+    unsigned int wr_strhigh; //The most of each the documents have used, since the last JSWR_TRIM_WINDOW resets.
+    unsigned int wr_tapehigh;
+    unsigned int wr_arenahigh;
+    unsigned int wr_resets;
+    jswrsink_fn wr_sink;
+    void * wr_sinkdata;
+    char * wr_sinkbuf;
+    unsigned int wr_sinkbufcap;
+    unsigned int wr_sinkbufsize;
+    int wr_sinkfd;
+    unsigned int setting_chunksize;
+    jswrstate_t wr_state;
+    jswrtok_t wr_gentok;
+    unsigned char wr_streaming;
+    const unsigned char * wr_readtape; //Where jswrwriter_read() carries on from.
+    unsigned int wr_readindex;
+    unsigned int wr_readpos; //How much of the string data it's handed out already.
+    int wr_error;
+    jswrstate_t wr_checkstate;
+    int wr_checkerror;
+    unsigned int wr_checkpos;
+    unsigned char setting_validate;
+    unsigned int setting_maxdepth;
+    unsigned int setting_threads;
     unsigned char setting_allowextradata;
     unsigned char setting_allowrootdata;
     unsigned char setting_uselines;
+    char * wr_indent;
+    unsigned int wr_indentsize;
+    unsigned int setting_indentwidth;
+    unsigned char setting_indentspaces;
+    unsigned int setting_compact;
+    unsigned char setting_escape;
+    unsigned char setting_utf8;
+    unsigned char setting_nonfinite;
+    unsigned char setting_rawcheck;
+    jswrscan_fn wr_scan; //The escape scan for this CPU, picked when it's set up so writers on other threads never share it.
+    jswrcache_t * wr_cache;
+    jswrkeys_t * wr_keys;
+    jswrcacheopen_t wr_cacheopen[JSWR_CACHE_DEPTH];
+    unsigned int wr_cachedepth;
 } jswrwriter_obj;
 
 /**
@@ -124,6 +438,130 @@ JSWR_API void jswrwriter_set_style(const unsigned char style, jswrwriter_obj * j
 */
 JSWR_API void jswrwriter_set_leniency(const unsigned char allowextradata, const unsigned char allowrootdata, jswrwriter_obj * jswr);
 
+/**
+* (JSWR Writer): Sets the beautified indent for each level: indent_width tabs, or spaces if use_spaces is true.
+*/
+JSWR_API void jswrwriter_set_indent(const unsigned int indent_width, const unsigned char use_spaces, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Keeps beautified arrays of up to max_items plain values on one line. 0 turns it off. Not used when streaming.
+*/
+JSWR_API void jswrwriter_set_compact(const unsigned int max_items, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Sets how deep objects/arrays can be nested, up to JSWR_MAX_DEPTH. Going deeper is a JSWR_ERROR_TOODEEP.
+*/
+JSWR_API void jswrwriter_set_max_depth(const unsigned int max_depth, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Sets the extra string escaping (JSWR_ESCAPE_*), and how invalid UTF-8 is handled (JSWR_UTF8_*).
+*/
+JSWR_API void jswrwriter_set_escaping(const unsigned char escape_flags, const unsigned char utf8_mode, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): If true, raw JSON is checked to be a single well-formed value when it's written. Otherwise it's trusted as-is.
+*/
+JSWR_API void jswrwriter_set_raw_check(const unsigned char raw_check, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Sets how NaN and infinite floats/doubles are written (JSWR_NONFINITE_*).
+*/
+JSWR_API void jswrwriter_set_nonfinite(const unsigned char nonfinite_mode, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Pre-sizes the writer's string data, and sets whether its capacity is kept between parses (it is by default).
+*/
+JSWR_API void jswrwriter_set_buffer(const unsigned int initial_size, const unsigned char keep_capacity, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Reserves room for a number of commands, so they're allocated once up front.
+*/
+JSWR_API void jswrwriter_reserve_tokens(const unsigned int token_count, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Clears the JSON command data, keeping its memory to be used again.
+*/
+JSWR_API void jswrwriter_clear_tokens(jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Readies the writer for a new document, clearing the commands and string data but keeping their memory (trimmed to what the documents have been using).
+*/
+JSWR_API void jswrwriter_reset(jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Sets the most memory (in bytes) each of the string data, commands and string arena keep past a reset. 0 sets no limit past the usual trimming.
+*/
+JSWR_API void jswrwriter_set_trim(const unsigned int trim_size, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Sets whether each command is checked as it's generated, so errors are caught right away. Commands already generated are checked now.
+*/
+JSWR_API void jswrwriter_set_validate(const unsigned char validate, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Gives the first error found while validating (JSWR_SUCCESS if none), and the index of the command that caused it.
+*/
+JSWR_API int jswrwriter_get_error(unsigned int * token_index, jswrwriter_obj * jswr);
+
+#ifdef JSWR_THREADS
+/**
+* (JSWR Writer): Sets how many threads parse can use. The items of a large root array are split between them. 1 (the default) doesn't use any.
+*/
+JSWR_API void jswrwriter_set_threads(const unsigned int thread_count, jswrwriter_obj * jswr);
+#endif
+
+/**
+* (JSWR Writer): Sets a callback as the output sink. The callback returns how many bytes it wrote.
+*/
+JSWR_API void jswrwriter_set_sink_callback(jswrsink_fn sink, void * userdata, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Sets an open file as the output sink.
+*/
+JSWR_API void jswrwriter_set_sink_file(FILE * file, jswrwriter_obj * jswr);
+
+#ifndef JSWR_NO_FD
+/**
+* (JSWR Writer): Sets a raw file descriptor as the output sink.
+*/
+JSWR_API void jswrwriter_set_sink_fd(const int fd, jswrwriter_obj * jswr);
+#endif
+
+/**
+* (JSWR Writer): Sets a fixed, caller-owned buffer as the output sink. The amount written is kept in wr_sinkbufsize.
+*/
+JSWR_API void jswrwriter_set_sink_buffer(char * buf, const unsigned int buf_size, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Removes the output sink, so the JSON is kept in the writer's string data.
+*/
+JSWR_API void jswrwriter_set_sink_none(jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Sets how many bytes are gathered before they're flushed to the output sink.
+*/
+JSWR_API void jswrwriter_set_chunksize(const unsigned int chunk_size, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Starts streaming mode. The JSON is checked and written as each generate function is used, without keeping the commands.
+*/
+JSWR_API void jswrwriter_stream_begin(jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Ends streaming mode, flushing what's left to the output sink. Can output results.
+*/
+JSWR_API int jswrwriter_stream_end(jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Starts reading the JSON commands out in pieces, with jswrwriter_read().
+*/
+JSWR_API void jswrwriter_read_begin(jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Writes the next (up to) cap bytes of JSON into buf, carrying on from the last read. Gives back 0 in out_size once it's all read. Can output results.
+*/
+JSWR_API int jswrwriter_read(char * buf, const unsigned int cap, unsigned int * out_size, jswrwriter_obj * jswr);
+
 /**
 * (JSWR Writer): Generates an int.
 */
@@ -134,11 +572,26 @@ JSWR_API void jswrwriter_gen_int(const int input_int, jswrwriter_obj * jswr);
 */
 JSWR_API void jswrwriter_gen_uint(const unsigned int input_int, jswrwriter_obj * jswr);
 
+/**
+* (JSWR Writer): Generates a 64-bit int.
+*/
+JSWR_API void jswrwriter_gen_int64(const jswr_i64 input_int, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Generates an unsigned 64-bit int.
+*/
+JSWR_API void jswrwriter_gen_uint64(const jswr_u64 input_int, jswrwriter_obj * jswr);
+
 /**
 * (JSWR Writer): Generates a float.
 */
 JSWR_API void jswrwriter_gen_float(const float input_float, jswrwriter_obj * jswr);
 
+/**
+* (JSWR Writer): Generates a double.
+*/
+JSWR_API void jswrwriter_gen_double(const double input_double, jswrwriter_obj * jswr);
+
 /**
 * (JSWR Writer): Generates a bool value (true/false). [NEW!]
 */
@@ -190,10 +643,112 @@ JSWR_API void jswrwriter_gen_beautify_break(jswrwriter_obj * jswr);
 JSWR_API void jswrwriter_gen_string(const char * input_str, const unsigned int input_str_size, jswrwriter_obj * jswr);
 
 /**
-* (JSWR Writer): Generates a "raw" string.
+* (JSWR Writer): Generates raw JSON, written as-is (no quotes or escaping), such as a pre-written value.
 */
 JSWR_API void jswrwriter_gen_raw(const char * input_str, const unsigned int input_str_size, jswrwriter_obj * jswr);
 
+/**
+* (JSWR Writer): Generates a string without copying it. The string has to stay around until the JSON is parsed.
+*/
+JSWR_API void jswrwriter_gen_string_ref(const char * input_str, const unsigned int input_str_size, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Generates raw JSON without copying it. The string has to stay around until the JSON is parsed.
+*/
+JSWR_API void jswrwriter_gen_raw_ref(const char * input_str, const unsigned int input_str_size, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Generates a whole array of ints as one command. When beautified, group items are written per line (all on one line if 0).
+*/
+JSWR_API void jswrwriter_gen_int_array(const int * input_ints, const unsigned int count, const unsigned int group, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Generates a whole array of doubles as one command. When beautified, group items are written per line (all on one line if 0).
+*/
+JSWR_API void jswrwriter_gen_double_array(const double * input_doubles, const unsigned int count, const unsigned int group, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Generates a whole array of booleans (true/false) as one command. When beautified, group items are written per line (all on one line if 0).
+*/
+JSWR_API void jswrwriter_gen_bool_array(const unsigned char * input_bools, const unsigned int count, const unsigned int group, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Generates a whole array of '\0' ended strings as one command. A NULL string is written as null. When beautified, group items are written per line (all on one line if 0).
+*/
+JSWR_API void jswrwriter_gen_string_array(const char * const * input_strs, const unsigned int count, const unsigned int group, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Generates the commands of another writer (child) in place, as a single value. They're moved rather than copied, leaving child empty.
+*/
+JSWR_API void jswrwriter_gen_fragment(jswrwriter_obj * child, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Sets up a table of interned keys. It can be shared between writers.
+*/
+JSWR_API void jswrwriter_keys_init(jswrkeys_t * keys);
+
+/**
+* (JSWR Writer): Frees a key table's data. The commands using its keys have to be written or cleared first.
+*/
+JSWR_API void jswrwriter_keys_free(jswrkeys_t * keys);
+
+/**
+* (JSWR Writer): Adds a key to the table, escaped once up front, giving back its handle for jswrwriter_gen_key().
+*/
+JSWR_API unsigned int jswrwriter_keys_add(const char * key, const unsigned int key_size, jswrkeys_t * keys);
+
+/**
+* (JSWR Writer): Sets the key table used by jswrwriter_gen_key().
+*/
+JSWR_API void jswrwriter_set_keys(jswrkeys_t * keys, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Generates an interned key (or string) by its handle. The same as generating the key's string, but lighter.
+*/
+JSWR_API void jswrwriter_gen_key(const unsigned int handle, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Generates a key escaped ahead of time. key holds the key, followed right after by its escaped form (quoted, with ": " after it) of escaped_size. Isn't copied.
+* An escaped form that isn't quoted with ": " after it gives JSWR_ERROR_BADKEY.
+*/
+JSWR_API void jswrwriter_gen_key_ref(const char * key, const unsigned int key_size, const unsigned int escaped_size, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Generates a struct as an object, from its description (see JSWR_STRUCT), as a single command. It's copied, strings included.
+*/
+JSWR_API void jswrwriter_gen_struct(const void * data, const jswrstruct_t * desc, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Generates a struct without copying it. It has to stay around (and unchanged) until the writer is parsed.
+*/
+JSWR_API void jswrwriter_gen_struct_ref(const void * data, const jswrstruct_t * desc, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Sets up a cache of written values, holding up to max_size bytes. It can be shared between writers.
+*/
+JSWR_API void jswrwriter_cache_init(jswrcache_t * cache, const unsigned int max_size);
+
+/**
+* (JSWR Writer): Frees a cache's data. The writers using it have to be done with it.
+*/
+JSWR_API void jswrwriter_cache_free(jswrcache_t * cache);
+
+/**
+* (JSWR Writer): Sets the cache used by jswrwriter_cache_begin(). NULL (the default) turns caching off.
+*/
+JSWR_API void jswrwriter_set_cache(jswrcache_t * cache, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Starts a value cached under a key. Gives back 1 if it was found, and has been generated from the cache, so it shouldn't be generated again.
+* Gives back 0 otherwise, and the value should be generated as usual, then followed by jswrwriter_cache_end().
+*/
+JSWR_API int jswrwriter_cache_begin(const char * key, const unsigned int key_size, jswrwriter_obj * jswr);
+
+/**
+* (JSWR Writer): Ends a value started with jswrwriter_cache_begin() (that wasn't found), and adds it to the cache.
+*/
+JSWR_API void jswrwriter_cache_end(jswrwriter_obj * jswr);
+
 /**
 * (JSWR Writer): Outputs a list of the commands used for the JSON writing.
 */
@@ -204,180 +759,832 @@ JSWR_API void jswrwriter_debugprint(jswrwriter_obj * jswr);
 */
 JSWR_API int jswrwriter_parse(jswrwriter_obj * jswr);
 
+/**
+* (JSWR Writer): Gives the exact size the JSON commands would be written to (without the '\0'), without writing them or growing the string data. Gives back the same result as parsing would.
+*/
+JSWR_API int jswrwriter_measure(unsigned int * size, jswrwriter_obj * jswr);
+
 /**
 * (JSWR Writer): Saves the writer's string data to a file. Can output results.
 */
 JSWR_API int jswrwriter_filewrite(const char * filename, jswrwriter_obj * jswr);
 
+/**
+* (JSWR Writer): Parses the JSON command data straight into a file, in chunks. Can output results.
+*/
+JSWR_API int jswrwriter_fileparse(const char * filename, jswrwriter_obj * jswr);
+
 #ifndef JSWR_HEADER
 
+static jswrscan_fn jswrwriter_pickscan(void);
+
 JSWR_API void jswrwriter_init(jswrwriter_obj * jswr)
 {
     jswr->wr_size=0;
     jswr->wr_level=0;
 	jswr->wr_addbreak=0;
-    jswr->wr_token=(jswrtok_t *) malloc(0);
-    jswr->wr_str=(char *) malloc(0);
+    jswr->wr_tape=NULL;
+    jswr->wr_tapesize=0;
+    jswr->wr_tapecap=0;
+    jswr->wr_arena=NULL;
+    jswr->wr_arenacur=NULL;
+    jswr->wr_frags=NULL;
+    jswr->wr_fragcount=0;
+    jswr->wr_fragcap=0;
+    jswr->wr_str=(char *) malloc(sizeof(char) * JSWR_STR_MINSIZE);
+    jswr->wr_str[0]='\0';
     jswr->wr_strsize=0;
+    jswr->wr_strcap=JSWR_STR_MINSIZE;
+    jswr->setting_strinit=JSWR_STR_MINSIZE;
+    jswr->setting_keepbuffer=1;
+    jswr->wr_scan=jswrwriter_pickscan();
+    jswr->setting_trimsize=0;
+    jswr->wr_strhigh=0;
+    jswr->wr_tapehigh=0;
+    jswr->wr_arenahigh=0;
+    jswr->wr_resets=0;
+    jswr->wr_sink=NULL;
+    jswr->wr_sinkdata=NULL;
+    jswr->wr_sinkbuf=NULL;
+    jswr->wr_sinkbufcap=0;
+    jswr->wr_sinkbufsize=0;
+    jswr->wr_sinkfd=-1;
+    jswr->wr_measure=0;
+    jswr->wr_measured=0;
+    jswr->setting_chunksize=JSWR_CHUNK_SIZE;
+    jswr->wr_streaming=0;
+    jswr->wr_readtape=NULL;
+    jswr->wr_readindex=0;
+    jswr->wr_readpos=0;
+    jswr->wr_error=JSWR_SUCCESS;
+    jswr->wr_checkerror=JSWR_SUCCESS;
+    jswr->wr_checkpos=0;
+    jswr->setting_validate=0;
+    jswr->setting_maxdepth=JSWR_MAX_DEPTH;
+    jswr->setting_threads=1;
     //
     jswr->setting_allowextradata=0;
     jswr->setting_allowrootdata=0;
     jswr->setting_uselines=1;
+    jswr->wr_indent=NULL;
+    jswr->wr_indentsize=0;
+    jswr->setting_indentwidth=1;
+    jswr->setting_indentspaces=0;
+    jswr->setting_compact=0;
+    jswr->setting_escape=JSWR_ESCAPE_DEFAULT;
+    jswr->setting_utf8=JSWR_UTF8_NONE;
+    jswr->setting_nonfinite=JSWR_NONFINITE_NULL;
+    jswr->setting_rawcheck=0;
+    jswr->wr_cache=NULL;
+    jswr->wr_keys=NULL;
+    jswr->wr_cachedepth=0;
 	return;
 }
 
 JSWR_API void jswrwriter_free(jswrwriter_obj * jswr)
 {
-    unsigned int i;
-    for (i=0;i<jswr->wr_size;i++)
+    jswrblock_t * block;
+    while (jswr->wr_arena!=NULL)
     {
-        free(jswr->wr_token[i].str);
+        block=jswr->wr_arena->next;
+        free(jswr->wr_arena);
+        jswr->wr_arena=block;
     }
-    free(jswr->wr_token);
+    while (jswr->wr_fragcount>0)
+        free(jswr->wr_frags[--jswr->wr_fragcount]);
+    free(jswr->wr_frags);
+    free(jswr->wr_tape);
     free(jswr->wr_str);
+    free(jswr->wr_indent);
 	return;
 }
 
-static void jswrwriter_putc(const char c, jswrwriter_obj * jswr)
+static void jswrwriter_resizestr(const unsigned int new_cap, jswrwriter_obj * jswr)
 {
-    jswr->wr_strsize+=1;
-    jswr->wr_str= (char *) realloc(jswr->wr_str, sizeof(char) * jswr->wr_strsize+1);
-    jswr->wr_str[jswr->wr_strsize-1]= c;
-    jswr->wr_str[jswr->wr_strsize]='\0';
+    jswr->wr_str= (char *) realloc(jswr->wr_str, sizeof(char) * new_cap);
+    jswr->wr_strcap=new_cap;
 }
 
-static void jswrwriter_puts(const char * c, jswrwriter_obj * jswr)
+static void jswrwriter_growstr(const unsigned int extra, jswrwriter_obj * jswr) //Doubles the capacity until extra chars (and the '\0') fit.
 {
-    jswr->wr_strsize+=strlen(c);
-    jswr->wr_str= (char *) realloc(jswr->wr_str, sizeof(char) * jswr->wr_strsize+1);
-    strcat(jswr->wr_str, c);
-    jswr->wr_str[jswr->wr_strsize]='\0';
+    unsigned int new_cap;
+    new_cap=jswr->wr_strcap;
+    if (new_cap<JSWR_STR_MINSIZE)
+        new_cap=JSWR_STR_MINSIZE;
+    while (new_cap<=jswr->wr_strsize+extra)
+        new_cap*=2;
+    jswrwriter_resizestr(new_cap, jswr);
 }
 
-static void jswrwriter_gen_x(const int type, jswrwriter_obj * jswr)
+static void jswrwriter_putn(const char * c, const unsigned int n, jswrwriter_obj * jswr)
 {
-    jswr->wr_size+=1;
-    jswr->wr_token = (jswrtok_t *) realloc(jswr->wr_token, sizeof(jswrtok_t) * jswr->wr_size);
-    jswr->wr_token[jswr->wr_size-1].tok_type=type;
-
-    jswr->wr_token[jswr->wr_size-1].str=(unsigned char *) malloc(sizeof(unsigned char) * 0);
-    jswr->wr_token[jswr->wr_size-1].str_size=0;
-    jswr->wr_token[jswr->wr_size-1].num_int=0;
-    jswr->wr_token[jswr->wr_size-1].num_float=0;
-	jswr->wr_token[jswr->wr_size-1].beauty_break=0;
-	if (jswr->wr_addbreak)
-		jswr->wr_token[jswr->wr_size-1].beauty_break=1;
-	jswr->wr_addbreak=0;
+    if (jswr->wr_measure)
+    {
+        jswr->wr_measured+=n;
+        return;
+    }
+    if (jswr->wr_strsize+n>=jswr->wr_strcap)
+        jswrwriter_growstr(n, jswr);
+    memcpy(jswr->wr_str+jswr->wr_strsize, c, n);
+    jswr->wr_strsize+=n;
+    jswr->wr_str[jswr->wr_strsize]='\0';
 }
 
-JSWR_API void jswrwriter_set_style(const unsigned char style, jswrwriter_obj * jswr)
+static void jswrwriter_putc(const char c, jswrwriter_obj * jswr)
 {
-    jswr->setting_uselines=style;
+    if (jswr->wr_measure)
+    {
+        jswr->wr_measured+=1;
+        return;
+    }
+    if (jswr->wr_strsize+1>=jswr->wr_strcap)
+        jswrwriter_growstr(1, jswr);
+    jswr->wr_str[jswr->wr_strsize]= c;
+    jswr->wr_strsize+=1;
+    jswr->wr_str[jswr->wr_strsize]='\0';
 }
 
-JSWR_API void jswrwriter_set_leniency(const unsigned char allowextradata, const unsigned char allowrootdata, jswrwriter_obj * jswr)
+static void jswrwriter_puts(const char * c, jswrwriter_obj * jswr)
 {
-    jswr->setting_allowextradata=allowextradata;
-    jswr->setting_allowrootdata=allowrootdata;
+    jswrwriter_putn(c, (unsigned int) strlen(c), jswr);
 }
 
-JSWR_API void jswrwriter_gen_int(const int input_int, jswrwriter_obj * jswr)
+static void jswrwriter_markstr(jswrwriter_obj * jswr) //Notes how much string data has been used before it's cleared, for trimming.
 {
-    jswrwriter_gen_x(JSWR_TOKEN_INT, jswr);
-    jswr->wr_token[jswr->wr_size-1].num_int=input_int;
-    return;
+    if (jswr->wr_strsize+1>jswr->wr_strhigh)
+        jswr->wr_strhigh=jswr->wr_strsize+1;
 }
 
-JSWR_API void jswrwriter_gen_uint(const unsigned int input_int, jswrwriter_obj * jswr)
+static void jswrwriter_clearstr(jswrwriter_obj * jswr) //Restarts the string data, trimming it back to its initial size if it's not kept.
 {
-    jswrwriter_gen_x(JSWR_TOKEN_UINT, jswr);
-    jswr->wr_token[jswr->wr_size-1].num_int=input_int;
-    return;
+    jswrwriter_markstr(jswr);
+    jswr->wr_strsize=0;
+    if (!jswr->setting_keepbuffer && jswr->wr_strcap>jswr->setting_strinit)
+        jswrwriter_resizestr(jswr->setting_strinit, jswr);
+    jswr->wr_str[0]='\0';
+}
+
+/*
+* The commands are kept on a tape of bytes. Each starts with a 1 byte opcode (the token type, with the flags below),
+* followed by its payload: ints, floats and doubles as their raw bytes,
+* and strings/bulk arrays as a varint size (and group) and a pointer to their data.
+* Fragments are laid out like bulk arrays, with their depth, command count and tape,
+* and so are cached values, with their last beautify break, size and written data.
+* Interned keys are laid out like strings, with their handle and key table, and keys escaped ahead of time like bulk arrays, with their escaped size.
+* Structs are laid out like bulk arrays too, with their field count and a jswrstructref_t.
+*/
+#define JSWR_TAPE_BREAK 0x80 //Opcode flag for a beautify break.
+#define JSWR_TAPE_TRUE 0x40 //Opcode flag for a true bool.
+#define JSWR_TAPE_MAXTOKEN 32 //The most bytes a single command can take.
+#define JSWR_TAPE_AVGTOKEN 8 //Roughly the bytes a command takes, for reserving.
+
+static void jswrwriter_resizetape(const unsigned int new_cap, jswrwriter_obj * jswr)
+{
+    jswr->wr_tape = (unsigned char *) realloc(jswr->wr_tape, sizeof(unsigned char) * new_cap);
+    jswr->wr_tapecap=new_cap;
+}
+
+JSWR_API void jswrwriter_reserve_tokens(const unsigned int token_count, jswrwriter_obj * jswr)
+{
+    if (jswr->wr_tapecap<token_count*JSWR_TAPE_AVGTOKEN)
+        jswrwriter_resizetape(token_count*JSWR_TAPE_AVGTOKEN, jswr);
+}
+
+static unsigned char * jswrwriter_putvarint(unsigned char * out, unsigned int num) //7 bits a byte, low bits first, with the high bit set on all but the last.
+{
+    while (num>=0x80)
+    {
+        *out++=(unsigned char) (num | 0x80);
+        num>>=7;
+    }
+    *out++=(unsigned char) num;
+    return out;
+}
+
+static const unsigned char * jswrwriter_getvarint(const unsigned char * in, unsigned int * num)
+{
+    unsigned int shift;
+    if (*in<0x80) //Most sizes fit in one byte.
+    {
+        *num=*in;
+        return in+1;
+    }
+    *num=0;
+    shift=0;
+    while (*in & 0x80)
+    {
+        *num|=(unsigned int) (*in & 0x7F) << shift;
+        shift+=7;
+        in++;
+    }
+    *num|=(unsigned int) *in << shift;
+    return in+1;
+}
+
+static void jswrwriter_tape_push(const jswrtok_t * tok, jswrwriter_obj * jswr)
+{
+    unsigned char * out;
+    float num_single;
+    if (jswr->wr_tapesize+JSWR_TAPE_MAXTOKEN>jswr->wr_tapecap)
+        jswrwriter_resizetape(jswr->wr_tapecap ? jswr->wr_tapecap*2 : JSWR_TAPE_MINSIZE, jswr);
+    out=jswr->wr_tape+jswr->wr_tapesize;
+    *out=(unsigned char) tok->tok_type;
+    if (tok->beauty_break)
+        *out|=JSWR_TAPE_BREAK;
+    if (tok->tok_type==JSWR_TOKEN_BOOL && tok->num_int)
+        *out|=JSWR_TAPE_TRUE;
+    out++;
+    switch (tok->tok_type)
+    {
+        case JSWR_TOKEN_INT:
+        case JSWR_TOKEN_UINT:
+            memcpy(out, &tok->num_int, sizeof(tok->num_int));
+            out+=sizeof(tok->num_int);
+            break;
+        case JSWR_TOKEN_INT64:
+        case JSWR_TOKEN_UINT64:
+            memcpy(out, &tok->num_long, sizeof(tok->num_long));
+            out+=sizeof(tok->num_long);
+            break;
+        case JSWR_TOKEN_FLOAT:
+        case JSWR_TOKEN_UFLOAT:
+            num_single=(float) tok->num_double;
+            memcpy(out, &num_single, sizeof(num_single));
+            out+=sizeof(num_single);
+            break;
+        case JSWR_TOKEN_DOUBLE:
+            memcpy(out, &tok->num_double, sizeof(tok->num_double));
+            out+=sizeof(tok->num_double);
+            break;
+        case JSWR_TOKEN_INTARRAY:
+        case JSWR_TOKEN_DOUBLEARRAY:
+        case JSWR_TOKEN_BOOLARRAY:
+        case JSWR_TOKEN_STRINGARRAY:
+        case JSWR_TOKEN_FRAGMENT:
+        case JSWR_TOKEN_CACHED:
+        case JSWR_TOKEN_KEYREF:
+        case JSWR_TOKEN_STRUCT:
+            out=jswrwriter_putvarint(out, (unsigned int) tok->num_int);
+            //Fall through - the size and data follow, like a string's.
+        case JSWR_TOKEN_STRING:
+        case JSWR_TOKEN_RAW:
+        case JSWR_TOKEN_KEY:
+            out=jswrwriter_putvarint(out, tok->str_size);
+            memcpy(out, &tok->str, sizeof(tok->str));
+            out+=sizeof(tok->str);
+            break;
+        default:
+            break;
+    }
+    jswr->wr_tapesize=(unsigned int) (out-jswr->wr_tape);
+    jswr->wr_size+=1;
+}
+
+static const unsigned char * jswrwriter_tape_read(const unsigned char * in, jswrtok_t * tok) //Decodes the command at in, returning where the next one starts.
+{
+    unsigned int num;
+    float num_single;
+    tok->tok_type=(jswrtype_t) (*in & ~(JSWR_TAPE_BREAK | JSWR_TAPE_TRUE));
+    tok->beauty_break=(*in & JSWR_TAPE_BREAK)!=0;
+    tok->num_int=(*in & JSWR_TAPE_TRUE)!=0;
+    in++;
+    switch (tok->tok_type)
+    {
+        case JSWR_TOKEN_INT:
+        case JSWR_TOKEN_UINT:
+            memcpy(&tok->num_int, in, sizeof(tok->num_int));
+            in+=sizeof(tok->num_int);
+            break;
+        case JSWR_TOKEN_INT64:
+        case JSWR_TOKEN_UINT64:
+            memcpy(&tok->num_long, in, sizeof(tok->num_long));
+            in+=sizeof(tok->num_long);
+            break;
+        case JSWR_TOKEN_FLOAT:
+        case JSWR_TOKEN_UFLOAT:
+            memcpy(&num_single, in, sizeof(num_single));
+            tok->num_double=num_single;
+            in+=sizeof(num_single);
+            break;
+        case JSWR_TOKEN_DOUBLE:
+            memcpy(&tok->num_double, in, sizeof(tok->num_double));
+            in+=sizeof(tok->num_double);
+            break;
+        case JSWR_TOKEN_INTARRAY:
+        case JSWR_TOKEN_DOUBLEARRAY:
+        case JSWR_TOKEN_BOOLARRAY:
+        case JSWR_TOKEN_STRINGARRAY:
+        case JSWR_TOKEN_FRAGMENT:
+        case JSWR_TOKEN_CACHED:
+        case JSWR_TOKEN_KEYREF:
+        case JSWR_TOKEN_STRUCT:
+            in=jswrwriter_getvarint(in, &num);
+            tok->num_int=(int) num;
+            //Fall through - the size and data follow, like a string's.
+        case JSWR_TOKEN_STRING:
+        case JSWR_TOKEN_RAW:
+        case JSWR_TOKEN_KEY:
+            in=jswrwriter_getvarint(in, &tok->str_size);
+            memcpy(&tok->str, in, sizeof(tok->str));
+            in+=sizeof(tok->str);
+            break;
+        default:
+            break;
+    }
+    return in;
+}
+
+#define JSWR_BLOCK_HEADER ((sizeof(jswrblock_t)+7) & ~((size_t) 7))
+#define JSWR_BLOCK_DATA(block) ((unsigned char *) (block) + JSWR_BLOCK_HEADER)
+
+/*
+* Takes room from the string arena. Strings are packed in order into large blocks, which are only freed all at once.
+* Blocks are kept when the arena is cleared, and get used again in the same order.
+* The room starts at a multiple of align, which has to be a power of two up to 8 (1 for strings).
+*/
+static unsigned char * jswrwriter_arena_alloc(const unsigned int size, const unsigned int align, jswrwriter_obj * jswr)
+{
+    jswrblock_t * block;
+    unsigned int block_cap,start;
+    block=jswr->wr_arenacur;
+    if (block!=NULL)
+    {
+        start=(block->size+align-1) & ~(align-1);
+        if (start<=block->cap && block->cap-start>=size)
+        {
+            block->size=start+size;
+            return JSWR_BLOCK_DATA(block)+start;
+        }
+    }
+    if (block!=NULL && block->next!=NULL && block->next->cap>=size)
+        block=block->next;
+    else
+    {
+        block_cap=JSWR_ARENA_BLOCKSIZE;
+        if (block_cap<size)
+            block_cap=size;
+        block=(jswrblock_t *) malloc(JSWR_BLOCK_HEADER+block_cap);
+        block->cap=block_cap;
+        block->next=NULL;
+        if (jswr->wr_arenacur==NULL)
+            jswr->wr_arena=block;
+        else
+        {
+            block->next=jswr->wr_arenacur->next;
+            jswr->wr_arenacur->next=block;
+        }
+    }
+    block->size=size;
+    jswr->wr_arenacur=block;
+    return JSWR_BLOCK_DATA(block);
+}
+
+static void jswrwriter_initstate(jswrstate_t * st);
+
+JSWR_API void jswrwriter_clear_tokens(jswrwriter_obj * jswr)
+{
+    jswrblock_t * block;
+    for (block=jswr->wr_arena;block!=NULL;block=block->next)
+        block->size=0;
+    jswr->wr_arenacur=jswr->wr_arena;
+    while (jswr->wr_fragcount>0)
+        free(jswr->wr_frags[--jswr->wr_fragcount]);
+    jswr->wr_size=0;
+    jswr->wr_tapesize=0;
+    jswr->wr_addbreak=0;
+    jswr->wr_cachedepth=0;
+    jswr->wr_readtape=NULL; //A read in progress can't carry on past the commands it was reading.
+    jswrwriter_initstate(&jswr->wr_checkstate);
+    jswr->wr_checkerror=JSWR_SUCCESS;
+    jswr->wr_checkpos=0;
+}
+
+/*
+* Arena blocks are kept in order until they'd go past limit, and the rest are freed.
+*/
+static void jswrwriter_trimarena(const unsigned int limit, jswrwriter_obj * jswr)
+{
+    jswrblock_t ** link;
+    jswrblock_t * block;
+    unsigned int kept;
+    kept=0;
+    link=&jswr->wr_arena;
+    while (*link!=NULL)
+    {
+        block=*link;
+        if (kept+block->cap<=limit)
+        {
+            kept+=block->cap;
+            link=&block->next;
+        }
+        else
+        {
+            *link=block->next;
+            free(block);
+        }
+    }
+    jswr->wr_arenacur=jswr->wr_arena;
+}
+
+/*
+* Releases the memory a long-lived writer has stopped using, so one unusually large document doesn't leave it holding onto it.
+* Every JSWR_TRIM_WINDOW resets, anything over twice the most the documents in between used is shrunk back to that most.
+* Growing doubles, so documents of about the same size never trip it, and go on without allocating.
+* The trim size, when set, caps it on every reset as well.
+*/
+static void jswrwriter_trim(jswrwriter_obj * jswr)
+{
+    unsigned int limit;
+    jswr->wr_resets++;
+    if (jswr->wr_resets>=JSWR_TRIM_WINDOW)
+    {
+        limit=jswr->wr_strhigh;
+        if (limit<jswr->setting_strinit)
+            limit=jswr->setting_strinit;
+        if (jswr->wr_strcap/2>limit)
+            jswrwriter_resizestr(limit, jswr);
+        limit=jswr->wr_tapehigh;
+        if (limit<JSWR_TAPE_MINSIZE)
+            limit=JSWR_TAPE_MINSIZE;
+        if (jswr->wr_tapecap/2>limit)
+            jswrwriter_resizetape(limit, jswr);
+        jswrwriter_trimarena(jswr->wr_arenahigh, jswr);
+        jswr->wr_strhigh=0;
+        jswr->wr_tapehigh=0;
+        jswr->wr_arenahigh=0;
+        jswr->wr_resets=0;
+    }
+    if (jswr->setting_trimsize==0)
+        return;
+    limit=jswr->setting_trimsize;
+    if (limit<jswr->setting_strinit)
+        limit=jswr->setting_strinit;
+    if (jswr->wr_strcap>limit)
+        jswrwriter_resizestr(limit, jswr);
+    limit=jswr->setting_trimsize;
+    if (limit<JSWR_TAPE_MINSIZE)
+        limit=JSWR_TAPE_MINSIZE;
+    if (jswr->wr_tapecap>limit)
+        jswrwriter_resizetape(limit, jswr);
+    jswrwriter_trimarena(jswr->setting_trimsize, jswr);
+}
+
+static void jswrwriter_markhigh(jswrwriter_obj * jswr) //Notes how much of each the document used, before it's cleared.
+{
+    jswrblock_t * block;
+    unsigned int used;
+    jswrwriter_markstr(jswr);
+    if (jswr->wr_tapesize+JSWR_TAPE_MAXTOKEN>jswr->wr_tapehigh) //A command is only added with that much room left.
+        jswr->wr_tapehigh=jswr->wr_tapesize+JSWR_TAPE_MAXTOKEN;
+    used=0;
+    for (block=jswr->wr_arena;block!=NULL && jswr->wr_arenacur!=NULL;block=block->next) //Blocks are used in order, up to the current one.
+    {
+        used+=block->cap;
+        if (block==jswr->wr_arenacur)
+            break;
+    }
+    if (used>jswr->wr_arenahigh)
+        jswr->wr_arenahigh=used;
+}
+
+JSWR_API void jswrwriter_reset(jswrwriter_obj * jswr)
+{
+    jswrwriter_markhigh(jswr);
+    jswrwriter_clear_tokens(jswr);
+    jswr->wr_strsize=0;
+    jswr->wr_level=0;
+    jswr->wr_streaming=0;
+    jswr->wr_error=JSWR_SUCCESS;
+    jswrwriter_trim(jswr);
+    jswr->wr_str[0]='\0';
+}
+
+JSWR_API void jswrwriter_set_trim(const unsigned int trim_size, jswrwriter_obj * jswr)
+{
+    jswr->setting_trimsize=trim_size;
+}
+
+static jswrtok_t * jswrwriter_gen_x(const int type, jswrwriter_obj * jswr)
+{
+    jswrtok_t * tok;
+    tok=&jswr->wr_gentok; //Filled in here, then written right away (streaming) or added to the tape by gen_end.
+    tok->tok_type=(jswrtype_t) type;
+    tok->str=NULL; //Only strings carry data, which is kept in the arena.
+    tok->str_size=0;
+    tok->num_int=0;
+    tok->num_double=0;
+    tok->num_long=0;
+	tok->beauty_break=0;
+	if (jswr->wr_addbreak)
+		tok->beauty_break=1;
+	jswr->wr_addbreak=0;
+    return tok;
+}
+
+static void jswrwriter_gen_str(const int type, const char * input_str, const unsigned int input_str_size, const int borrow, jswrwriter_obj * jswr)
+{
+    jswrtok_t * tok;
+    unsigned char * str_copy;
+    tok=jswrwriter_gen_x(type, jswr);
+    tok->str_size=input_str_size;
+    if (borrow || jswr->wr_streaming) //Streamed strings are written before the call returns, so they never need a copy.
+    {
+        tok->str=(const unsigned char *) input_str;
+        return;
+    }
+    str_copy=jswrwriter_arena_alloc(input_str_size+1, 1, jswr);
+    memcpy(str_copy,input_str,input_str_size);
+    str_copy[input_str_size]='\0';
+    tok->str=str_copy;
+}
+
+static void jswrwriter_gen_bulk(const int type, const void * input_data, const unsigned int data_size, const unsigned int count, const unsigned int group, jswrwriter_obj * jswr)
+{
+    jswrtok_t * tok;
+    unsigned char * data_copy;
+    tok=jswrwriter_gen_x(type, jswr);
+    tok->str_size=count; //Bulk arrays keep their item count in str_size, and the items per line in num_int.
+    tok->num_int=(int) group;
+    if (jswr->wr_streaming || data_size==0)
+    {
+        tok->str=(const unsigned char *) input_data;
+        return;
+    }
+    data_copy=jswrwriter_arena_alloc(data_size, 8, jswr);
+    memcpy(data_copy,input_data,data_size);
+    tok->str=data_copy;
+}
+
+static void jswrwriter_gen_end(jswrwriter_obj * jswr);
+
+/*
+* Checks that a bulk array's size in bytes fits an unsigned int, as the arena copies it.
+* One that doesn't is kept as just its error (like a bad fragment), given back when it's reached.
+*/
+static int jswrwriter_bulkfits(const unsigned int count, const unsigned int item_size, jswrwriter_obj * jswr)
+{
+    jswrtok_t * tok;
+    if (count<=((unsigned int) -1)/item_size)
+        return 1;
+    tok=jswrwriter_gen_x(JSWR_TOKEN_FRAGMENT, jswr);
+    tok->num_int=JSWR_ERROR_TOOLARGE;
+    return 0;
+}
+
+JSWR_API void jswrwriter_set_style(const unsigned char style, jswrwriter_obj * jswr)
+{
+    jswr->setting_uselines=style;
+}
+
+JSWR_API void jswrwriter_set_leniency(const unsigned char allowextradata, const unsigned char allowrootdata, jswrwriter_obj * jswr)
+{
+    jswr->setting_allowextradata=allowextradata;
+    jswr->setting_allowrootdata=allowrootdata;
+}
+
+JSWR_API void jswrwriter_set_indent(const unsigned int indent_width, const unsigned char use_spaces, jswrwriter_obj * jswr)
+{
+    jswr->setting_indentwidth=indent_width;
+    jswr->setting_indentspaces=use_spaces;
+    jswr->wr_indentsize=0; //Built again when it's next used.
+}
+
+JSWR_API void jswrwriter_set_compact(const unsigned int max_items, jswrwriter_obj * jswr)
+{
+    jswr->setting_compact=max_items;
+}
+
+JSWR_API void jswrwriter_set_max_depth(const unsigned int max_depth, jswrwriter_obj * jswr)
+{
+    jswr->setting_maxdepth=max_depth;
+    if (jswr->setting_maxdepth>JSWR_MAX_DEPTH)
+        jswr->setting_maxdepth=JSWR_MAX_DEPTH;
+}
+
+JSWR_API void jswrwriter_set_escaping(const unsigned char escape_flags, const unsigned char utf8_mode, jswrwriter_obj * jswr)
+{
+    jswr->setting_escape=escape_flags;
+    jswr->setting_utf8=utf8_mode;
+}
+
+JSWR_API void jswrwriter_set_raw_check(const unsigned char raw_check, jswrwriter_obj * jswr)
+{
+    jswr->setting_rawcheck=raw_check;
+}
+
+JSWR_API void jswrwriter_set_nonfinite(const unsigned char nonfinite_mode, jswrwriter_obj * jswr)
+{
+    jswr->setting_nonfinite=nonfinite_mode;
+}
+
+JSWR_API void jswrwriter_set_buffer(const unsigned int initial_size, const unsigned char keep_capacity, jswrwriter_obj * jswr)
+{
+    jswr->setting_strinit=initial_size;
+    if (jswr->setting_strinit<JSWR_STR_MINSIZE)
+        jswr->setting_strinit=JSWR_STR_MINSIZE;
+    jswr->setting_keepbuffer=keep_capacity;
+    if (jswr->wr_strcap<jswr->setting_strinit)
+        jswrwriter_resizestr(jswr->setting_strinit, jswr);
+}
+
+JSWR_API void jswrwriter_gen_int(const int input_int, jswrwriter_obj * jswr)
+{
+    jswrwriter_gen_x(JSWR_TOKEN_INT, jswr)->num_int=input_int;
+    jswrwriter_gen_end(jswr);
+    return;
+}
+
+JSWR_API void jswrwriter_gen_uint(const unsigned int input_int, jswrwriter_obj * jswr)
+{
+    jswrwriter_gen_x(JSWR_TOKEN_UINT, jswr)->num_int=input_int;
+    jswrwriter_gen_end(jswr);
+    return;
+}
+
+JSWR_API void jswrwriter_gen_int64(const jswr_i64 input_int, jswrwriter_obj * jswr)
+{
+    jswrwriter_gen_x(JSWR_TOKEN_INT64, jswr)->num_long=(jswr_u64) input_int;
+    jswrwriter_gen_end(jswr);
+    return;
+}
+
+JSWR_API void jswrwriter_gen_uint64(const jswr_u64 input_int, jswrwriter_obj * jswr)
+{
+    jswrwriter_gen_x(JSWR_TOKEN_UINT64, jswr)->num_long=input_int;
+    jswrwriter_gen_end(jswr);
+    return;
 }
 
 JSWR_API void jswrwriter_gen_float(const float input_float, jswrwriter_obj * jswr)
 {
-    jswrwriter_gen_x(JSWR_TOKEN_FLOAT, jswr);
-    jswr->wr_token[jswr->wr_size-1].num_float=input_float;
+    jswrwriter_gen_x(JSWR_TOKEN_FLOAT, jswr)->num_double=input_float;
+    jswrwriter_gen_end(jswr);
+    return;
+}
+
+JSWR_API void jswrwriter_gen_double(const double input_double, jswrwriter_obj * jswr)
+{
+    jswrwriter_gen_x(JSWR_TOKEN_DOUBLE, jswr)->num_double=input_double;
+    jswrwriter_gen_end(jswr);
     return;
 }
 
-JSWR_API void jswrwriter_gen_bool(const int input_int, jswrwriter_obj * jswr) //NEW!
+JSWR_API void jswrwriter_gen_bool(const unsigned int input_int, jswrwriter_obj * jswr) //NEW!
 {
-    jswrwriter_gen_x(JSWR_TOKEN_BOOL, jswr);
-    jswr->wr_token[jswr->wr_size-1].num_int=input_int;
+    jswrwriter_gen_x(JSWR_TOKEN_BOOL, jswr)->num_int=input_int;
+    jswrwriter_gen_end(jswr);
     return;
 }
 
 JSWR_API void jswrwriter_gen_true(jswrwriter_obj * jswr)
 {
     jswrwriter_gen_x(JSWR_TOKEN_TRUE, jswr);
+    jswrwriter_gen_end(jswr);
     return;
 }
 
 JSWR_API void jswrwriter_gen_false(jswrwriter_obj * jswr)
 {
     jswrwriter_gen_x(JSWR_TOKEN_FALSE, jswr);
+    jswrwriter_gen_end(jswr);
     return;
 }
 
 JSWR_API void jswrwriter_gen_null(jswrwriter_obj * jswr)
 {
     jswrwriter_gen_x(JSWR_TOKEN_NULL, jswr);
+    jswrwriter_gen_end(jswr);
     return;
 }
 
 JSWR_API void jswrwriter_gen_object_open(jswrwriter_obj * jswr)
 {
     jswrwriter_gen_x(JSWR_TOKEN_OBJOPEN, jswr);
+    jswrwriter_gen_end(jswr);
     return;
 }
 
 JSWR_API void jswrwriter_gen_object_close(jswrwriter_obj * jswr)
 {
     jswrwriter_gen_x(JSWR_TOKEN_OBJCLOSE, jswr);
+    jswrwriter_gen_end(jswr);
     return;
 }
 
 JSWR_API void jswrwriter_gen_array_open(jswrwriter_obj * jswr)
 {
     jswrwriter_gen_x(JSWR_TOKEN_ARRAYOPEN, jswr);
+    jswrwriter_gen_end(jswr);
     return;
 }
 
 JSWR_API void jswrwriter_gen_array_close(jswrwriter_obj * jswr)
 {
     jswrwriter_gen_x(JSWR_TOKEN_ARRAYCLOSE, jswr);
+    jswrwriter_gen_end(jswr);
     return;
 }
 
 JSWR_API void jswrwriter_gen_string(const char * input_str, const unsigned int input_str_size, jswrwriter_obj * jswr)
 {
-    jswrwriter_gen_x(JSWR_TOKEN_STRING, jswr);
-    jswr->wr_token[jswr->wr_size-1].str=(unsigned char *) realloc(jswr->wr_token[jswr->wr_size-1].str, sizeof(unsigned char) * input_str_size+1);
-    jswr->wr_token[jswr->wr_size-1].str_size=input_str_size;
-    memcpy(jswr->wr_token[jswr->wr_size-1].str,input_str,input_str_size);
-    jswr->wr_token[jswr->wr_size-1].str[input_str_size]='\0';
+    jswrwriter_gen_str(JSWR_TOKEN_STRING, input_str, input_str_size, 0, jswr);
+    jswrwriter_gen_end(jswr);
+    return;
+}
+
+JSWR_API void jswrwriter_gen_string_ref(const char * input_str, const unsigned int input_str_size, jswrwriter_obj * jswr)
+{
+    jswrwriter_gen_str(JSWR_TOKEN_STRING, input_str, input_str_size, 1, jswr);
+    jswrwriter_gen_end(jswr);
     return;
 }
 
 JSWR_API void jswrwriter_gen_raw(const char * input_str, const unsigned int input_str_size, jswrwriter_obj * jswr)
 {
-    jswrwriter_gen_x(JSWR_TOKEN_RAW, jswr);
-    jswr->wr_token[jswr->wr_size-1].str=(unsigned char *) realloc(jswr->wr_token[jswr->wr_size-1].str, sizeof(unsigned char) * input_str_size+1);
-    jswr->wr_token[jswr->wr_size-1].str_size=input_str_size;
-    memcpy(jswr->wr_token[jswr->wr_size-1].str,input_str,input_str_size);
-    jswr->wr_token[jswr->wr_size-1].str[input_str_size]='\0';
+    jswrwriter_gen_str(JSWR_TOKEN_RAW, input_str, input_str_size, 0, jswr);
+    jswrwriter_gen_end(jswr);
+    return;
+}
+
+JSWR_API void jswrwriter_gen_raw_ref(const char * input_str, const unsigned int input_str_size, jswrwriter_obj * jswr)
+{
+    jswrwriter_gen_str(JSWR_TOKEN_RAW, input_str, input_str_size, 1, jswr);
+    jswrwriter_gen_end(jswr);
+    return;
+}
+
+JSWR_API void jswrwriter_gen_int_array(const int * input_ints, const unsigned int count, const unsigned int group, jswrwriter_obj * jswr)
+{
+    if (jswrwriter_bulkfits(count, sizeof(int), jswr))
+        jswrwriter_gen_bulk(JSWR_TOKEN_INTARRAY, input_ints, sizeof(int) * count, count, group, jswr);
+    jswrwriter_gen_end(jswr);
+    return;
+}
+
+JSWR_API void jswrwriter_gen_double_array(const double * input_doubles, const unsigned int count, const unsigned int group, jswrwriter_obj * jswr)
+{
+    if (jswrwriter_bulkfits(count, sizeof(double), jswr))
+        jswrwriter_gen_bulk(JSWR_TOKEN_DOUBLEARRAY, input_doubles, sizeof(double) * count, count, group, jswr);
+    jswrwriter_gen_end(jswr);
+    return;
+}
+
+JSWR_API void jswrwriter_gen_bool_array(const unsigned char * input_bools, const unsigned int count, const unsigned int group, jswrwriter_obj * jswr)
+{
+    jswrwriter_gen_bulk(JSWR_TOKEN_BOOLARRAY, input_bools, sizeof(unsigned char) * count, count, group, jswr);
+    jswrwriter_gen_end(jswr);
+    return;
+}
+
+JSWR_API void jswrwriter_gen_string_array(const char * const * input_strs, const unsigned int count, const unsigned int group, jswrwriter_obj * jswr)
+{
+    const char ** str_copies;
+    unsigned int i,size;
+    char * str_copy;
+    if (!jswrwriter_bulkfits(count, sizeof(char *), jswr))
+    {
+        jswrwriter_gen_end(jswr);
+        return;
+    }
+    if (jswr->wr_streaming || count==0)
+        jswrwriter_gen_bulk(JSWR_TOKEN_STRINGARRAY, input_strs, 0, count, group, jswr);
+    else
+    {
+        str_copies=(const char **) jswrwriter_arena_alloc(sizeof(char *) * count, 8, jswr); //The pointers are copied too, so they can point at the copied strings.
+        for (i=0;i<count;i++)
+        {
+            str_copies[i]=NULL;
+            if (input_strs[i]==NULL)
+                continue;
+            size=(unsigned int) strlen(input_strs[i]);
+            str_copy=(char *) jswrwriter_arena_alloc(size+1, 1, jswr);
+            memcpy(str_copy,input_strs[i],size+1);
+            str_copies[i]=str_copy;
+        }
+        jswrwriter_gen_bulk(JSWR_TOKEN_STRINGARRAY, str_copies, 0, count, group, jswr);
+    }
+    jswrwriter_gen_end(jswr);
     return;
 }
 
 JSWR_API void jswrwriter_gen_beautify_break(jswrwriter_obj * jswr) //NEW!
 {
+    unsigned int depth;
     jswr->wr_addbreak=1;
+    depth=jswr->wr_cachedepth;
+    if (depth>JSWR_CACHE_DEPTH)
+        depth=JSWR_CACHE_DEPTH;
+    while (depth>0 && jswr->wr_cacheopen[depth-1].size_start==jswr->wr_size) //Values being cached that nothing has been generated in yet.
+    {
+        jswr->wr_cacheopen[depth-1].value_break=1;
+        depth--;
+    }
     return;
 }
 
-static char * jswrwriter_boolcheck(int num) //NEW!
+static unsigned int jswrwriter_u64digits(jswr_u64 num, char * out);
+
+static const char * jswrwriter_boolcheck(int num) //NEW!
 {
 	if (num)
 		return "TRUE";
@@ -386,18 +1593,41 @@ static char * jswrwriter_boolcheck(int num) //NEW!
 
 JSWR_API void jswrwriter_debugprint(jswrwriter_obj * jswr)
 {
-    unsigned int i;
+    unsigned int i,len;
+    char num_str[20];
+    const unsigned char * tape;
+    jswrtok_t tok;
+    tape=jswr->wr_tape;
     for (i=0;i<jswr->wr_size;i++)
     {
-        switch(jswr->wr_token[i].tok_type)
+        tape=jswrwriter_tape_read(tape, &tok);
+        switch(tok.tok_type)
         {
-            case JSWR_TOKEN_STRING: printf("%d STRING: %s",i,jswr->wr_token[i].str); break;
-            case JSWR_TOKEN_RAW: printf("%d RAW: %s",i,jswr->wr_token[i].str); break;
-            case JSWR_TOKEN_INT: printf("%d INT: %d",i,jswr->wr_token[i].num_int); break;
-            case JSWR_TOKEN_UINT: printf("%d UINT: %u",i,jswr->wr_token[i].num_int); break;
-            case JSWR_TOKEN_FLOAT: printf("%d FLOAT: %g",i,jswr->wr_token[i].num_float); break;
-            case JSWR_TOKEN_UFLOAT: printf("%d UFLOAT: %g",i,jswr->wr_token[i].num_float); break;
-			case JSWR_TOKEN_BOOL: printf("%d BOOL: %s",i,jswrwriter_boolcheck(jswr->wr_token[i].num_int)); break; //NEW! Might have it display true/false temporarily.
+            case JSWR_TOKEN_STRING: printf("%d STRING: %.*s",i,(int) tok.str_size,tok.str); break;
+            case JSWR_TOKEN_RAW: printf("%d RAW: %.*s",i,(int) tok.str_size,tok.str); break;
+            case JSWR_TOKEN_INT: printf("%d INT: %d",i,tok.num_int); break;
+            case JSWR_TOKEN_UINT: printf("%d UINT: %u",i,tok.num_int); break;
+            case JSWR_TOKEN_FLOAT: printf("%d FLOAT: %g",i,tok.num_double); break;
+            case JSWR_TOKEN_UFLOAT: printf("%d UFLOAT: %g",i,tok.num_double); break;
+            case JSWR_TOKEN_DOUBLE: printf("%d DOUBLE: %.17g",i,tok.num_double); break;
+			case JSWR_TOKEN_BOOL: printf("%d BOOL: %s",i,jswrwriter_boolcheck(tok.num_int)); break; //NEW! Might have it display true/false temporarily.
+            case JSWR_TOKEN_INTARRAY: printf("%d INT ARRAY: %u items",i,tok.str_size); break;
+            case JSWR_TOKEN_DOUBLEARRAY: printf("%d DOUBLE ARRAY: %u items",i,tok.str_size); break;
+            case JSWR_TOKEN_BOOLARRAY: printf("%d BOOL ARRAY: %u items",i,tok.str_size); break;
+            case JSWR_TOKEN_STRINGARRAY: printf("%d STRING ARRAY: %u items",i,tok.str_size); break;
+            case JSWR_TOKEN_FRAGMENT: printf("%d FRAGMENT: %u commands",i,tok.str_size); break;
+            case JSWR_TOKEN_CACHED: printf("%d CACHED: %.*s",i,(int) tok.str_size,tok.str); break;
+            case JSWR_TOKEN_KEY: printf("%d KEY: %u",i,tok.str_size); break;
+            case JSWR_TOKEN_KEYREF: printf("%d KEY REF: %.*s",i,(int) tok.str_size,tok.str); break;
+            case JSWR_TOKEN_STRUCT: printf("%d STRUCT: %u fields",i,tok.str_size); break;
+            case JSWR_TOKEN_INT64:
+                len=jswrwriter_u64digits((tok.num_long>>63) ? 0-tok.num_long : tok.num_long, num_str);
+                printf("%d INT64: %s%.*s",i,(tok.num_long>>63) ? "-" : "",(int) len,num_str+20-len);
+                break;
+            case JSWR_TOKEN_UINT64:
+                len=jswrwriter_u64digits(tok.num_long, num_str);
+                printf("%d UINT64: %.*s",i,(int) len,num_str+20-len);
+                break;
             case JSWR_TOKEN_TRUE: printf("%d TRUE",i); break;
             case JSWR_TOKEN_FALSE: printf("%d FALSE",i); break;
             case JSWR_TOKEN_NULL: printf("%d NULL",i); break;
@@ -407,7 +1637,7 @@ JSWR_API void jswrwriter_debugprint(jswrwriter_obj * jswr)
             case JSWR_TOKEN_ARRAYCLOSE: printf("%d (ARRAY CLOSE)",i); break;
             default: printf("%d ???",i); break;
         }
-		if (jswr->wr_token[i].beauty_break)
+		if (tok.beauty_break)
 			printf(" [+BREAK]");
 		printf("\n");
     }
@@ -423,10 +1653,23 @@ static int jswrwriter_istokenitem(int token_type, int allow_open)
             case JSWR_TOKEN_UINT: return 1; break;
             case JSWR_TOKEN_FLOAT: return 1; break;
             case JSWR_TOKEN_UFLOAT: return 1; break;
+            case JSWR_TOKEN_DOUBLE: return 1; break;
 			case JSWR_TOKEN_BOOL: return 1; break; //NEW!
             case JSWR_TOKEN_TRUE: return 1; break;
             case JSWR_TOKEN_FALSE: return 1; break;
             case JSWR_TOKEN_NULL: return 1; break;
+            case JSWR_TOKEN_RAW: return 1; break;
+            case JSWR_TOKEN_INTARRAY: return 1; break;
+            case JSWR_TOKEN_DOUBLEARRAY: return 1; break;
+            case JSWR_TOKEN_BOOLARRAY: return 1; break;
+            case JSWR_TOKEN_STRINGARRAY: return 1; break;
+            case JSWR_TOKEN_FRAGMENT: return 1; break;
+            case JSWR_TOKEN_CACHED: return 1; break;
+            case JSWR_TOKEN_KEY: return 1; break;
+            case JSWR_TOKEN_KEYREF: return 1; break;
+            case JSWR_TOKEN_INT64: return 1; break;
+            case JSWR_TOKEN_UINT64: return 1; break;
+            case JSWR_TOKEN_STRUCT: return 1; break;
             case JSWR_TOKEN_OBJOPEN:
                 if (allow_open)
                     return 1;
@@ -444,531 +1687,2732 @@ static int jswrwriter_istokenitem(int token_type, int allow_open)
     return 0;
 }
 
-static void jswrwriter_writetab(unsigned int pos, int level, jswrwriter_obj * jswr)
+/*
+* Writes a newline (if newline is set) and the indent for level, copied in one go from a run of them built up front.
+* The run is a newline and then indent characters, grown by doubling as deeper levels need it.
+*/
+static void jswrwriter_writeindent(const int level, const int newline, jswrwriter_obj * jswr)
 {
-    int i;
-	unsigned int temp_beauty;
-	temp_beauty=1;
-	if (jswr->wr_token[pos].beauty_break)
-		temp_beauty=0;
-    i=0;
-    if (jswr->setting_uselines && temp_beauty)
+    unsigned int size,new_size;
+    size=1+(unsigned int) level*jswr->setting_indentwidth;
+    if (size>jswr->wr_indentsize)
     {
-    if (pos>0)
-        jswrwriter_puts("\n", jswr);
-    for (i=0;i<level;i++)
-        jswrwriter_putc('\t', jswr);
+        new_size=64;
+        while (new_size<size)
+            new_size*=2;
+        jswr->wr_indent=(char *) realloc(jswr->wr_indent, sizeof(char) * new_size);
+        jswr->wr_indent[0]='\n';
+        memset(jswr->wr_indent+1, jswr->setting_indentspaces ? ' ' : '\t', new_size-1);
+        jswr->wr_indentsize=new_size;
     }
-    return;
+    if (newline)
+        jswrwriter_putn(jswr->wr_indent, size, jswr);
+    else
+        jswrwriter_putn(jswr->wr_indent+1, size-1, jswr);
 }
 
-static void jswrwriter_writetoken(unsigned int i, jswrwriter_obj * jswr)
+static void jswrwriter_writetab(const unsigned int beauty_break, int level, jswrstate_t * st, jswrwriter_obj * jswr)
 {
-    char num_str[256];
-    unsigned int a,a_exit;
-    if (i>=0)
-    {
-        if (i<jswr->wr_size)
-        {
-            switch(jswr->wr_token[i].tok_type)
-            {
+    if (jswr->setting_uselines && !beauty_break)
+        jswrwriter_writeindent(level, st->pos>0, jswr);
+    return;
+}
 
-            case JSWR_TOKEN_STRING:
-                jswrwriter_putc('"',jswr);
-                a=0;
-                a_exit=0;
-                while (a<jswr->wr_token[i].str_size && !a_exit)
-                {
-                    switch(jswr->wr_token[i].str[a])
-                    {
-                        case '\\':
-                        jswrwriter_puts("\\\\",jswr);
-                        break;
-                        case '"':
-                        jswrwriter_puts("\\\"",jswr);
-                        break;
-                        case '\0':
-                            a_exit=1;
-                        break;
-                        default:
-                        jswrwriter_putc(jswr->wr_token[i].str[a],jswr);
-                        break;
-                    }
-                    a++;
-                }
-                jswrwriter_putc('"',jswr);
-                break;
+#define JSWR_STOP_SLASH 1 //Stop at '/' as well.
+#define JSWR_STOP_HIGH 2 //Stop at non-ASCII bytes as well.
 
-            case JSWR_TOKEN_BOOL: //NEW!
-				if (jswr->wr_token[i].num_int)
-					jswrwriter_puts("true",jswr);
-				else
-					jswrwriter_puts("false",jswr);
-                break;
+/*
+* Escape letters for each byte. 'u' is written as \u00XX, and 0 means the byte is written as-is.
+* '/' is only escaped with JSWR_ESCAPE_SLASH, and '\0' ends the string instead.
+*/
+static const unsigned char jswrwriter_esctable[256]=
+{
+    'u','u','u','u','u','u','u','u','b','t','n','u','f','r','u','u',
+    'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u',
+    0,0,'"',0,0,0,0,0,0,0,0,0,0,0,0,'/',
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,'\\',0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+};
 
-			case JSWR_TOKEN_TRUE:
-                jswrwriter_puts("true",jswr);
-                break;
+static unsigned int jswrwriter_scan_scalar(const unsigned char * str, const unsigned int size, const unsigned int stop) //Finds the first byte that has to be escaped (or ends the string).
+{
+    unsigned int a;
+    for (a=0;a<size;a++)
+    {
+        if (jswrwriter_esctable[str[a]] && (str[a]!='/' || (stop & JSWR_STOP_SLASH)))
+            break;
+        if (str[a]>=0x80 && (stop & JSWR_STOP_HIGH))
+            break;
+    }
+    return a;
+}
 
-            case JSWR_TOKEN_FALSE:
-                jswrwriter_puts("false",jswr);
-                break;
+#ifdef JSWR_SIMD_SSE2
+static unsigned int jswrwriter_ctz(const unsigned int mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned int) index;
+#else
+    return (unsigned int) __builtin_ctz(mask);
+#endif
+}
 
-            case JSWR_TOKEN_NULL:
-                jswrwriter_puts("null",jswr);
-                break;
+static unsigned int jswrwriter_scan_sse2(const unsigned char * str, const unsigned int size, const unsigned int stop)
+{
+    unsigned int a,mask;
+    __m128i chunk,quote,slash,solidus,ctrl,high,found;
+    quote=_mm_set1_epi8('"');
+    slash=_mm_set1_epi8('\\');
+    solidus=(stop & JSWR_STOP_SLASH) ? _mm_set1_epi8('/') : quote;
+    ctrl=_mm_set1_epi8(0x1F);
+    high=(stop & JSWR_STOP_HIGH) ? _mm_set1_epi8((char) 0x80) : _mm_setzero_si128();
+    a=0;
+    while (a+16<=size)
+    {
+        chunk=_mm_loadu_si128((const __m128i *) (str+a));
+        found=_mm_or_si128(_mm_cmpeq_epi8(chunk,quote), _mm_cmpeq_epi8(chunk,slash));
+        found=_mm_or_si128(found, _mm_cmpeq_epi8(chunk,solidus));
+        found=_mm_or_si128(found, _mm_cmpeq_epi8(_mm_max_epu8(chunk,ctrl),ctrl)); //Control characters, including '\0'.
+        found=_mm_or_si128(found, _mm_and_si128(chunk,high));
+        mask=(unsigned int) _mm_movemask_epi8(found);
+        if (mask)
+            return a+jswrwriter_ctz(mask);
+        a+=16;
+    }
+    return a+jswrwriter_scan_scalar(str+a, size-a, stop);
+}
 
-            case JSWR_TOKEN_INT:
-                sprintf(num_str, "%d", jswr->wr_token[i].num_int);
-                jswrwriter_puts(num_str,jswr);
-                break;
+#ifdef JSWR_SIMD_AVX2
+JSWR_TARGET_AVX2 static unsigned int jswrwriter_scan_avx2(const unsigned char * str, const unsigned int size, const unsigned int stop)
+{
+    unsigned int a,mask;
+    __m256i chunk,quote,slash,solidus,ctrl,high,found;
+    quote=_mm256_set1_epi8('"');
+    slash=_mm256_set1_epi8('\\');
+    solidus=(stop & JSWR_STOP_SLASH) ? _mm256_set1_epi8('/') : quote;
+    ctrl=_mm256_set1_epi8(0x1F);
+    high=(stop & JSWR_STOP_HIGH) ? _mm256_set1_epi8((char) 0x80) : _mm256_setzero_si256();
+    a=0;
+    while (a+32<=size)
+    {
+        chunk=_mm256_loadu_si256((const __m256i *) (str+a));
+        found=_mm256_or_si256(_mm256_cmpeq_epi8(chunk,quote), _mm256_cmpeq_epi8(chunk,slash));
+        found=_mm256_or_si256(found, _mm256_cmpeq_epi8(chunk,solidus));
+        found=_mm256_or_si256(found, _mm256_cmpeq_epi8(_mm256_max_epu8(chunk,ctrl),ctrl));
+        found=_mm256_or_si256(found, _mm256_and_si256(chunk,high));
+        mask=(unsigned int) _mm256_movemask_epi8(found);
+        if (mask)
+            return a+jswrwriter_ctz(mask);
+        a+=32;
+    }
+    _mm256_zeroupper(); //The SSE2 code below isn't VEX encoded, so the upper halves have to be cleared first or it stalls on every call.
+    return a+jswrwriter_scan_sse2(str+a, size-a, stop);
+}
+
+static int jswrwriter_hasavx2(void)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0]<7)
+        return 0;
+    __cpuid(info, 1);
+    if (!(info[2] & (1<<27)) || (_xgetbv(0) & 6)!=6) //The OS has to save the AVX registers too.
+        return 0;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1<<5))!=0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2")!=0;
+#endif
+}
+#endif
+#endif
+
+static jswrscan_fn jswrwriter_pickscan(void)
+{
+#ifdef JSWR_SIMD_AVX2
+    if (jswrwriter_hasavx2())
+        return jswrwriter_scan_avx2;
+#endif
+#ifdef JSWR_SIMD_SSE2
+    return jswrwriter_scan_sse2;
+#else
+    return jswrwriter_scan_scalar;
+#endif
+}
+
+/*
+* Reads one UTF-8 character, giving back its length, or 0 if the bytes aren't valid UTF-8.
+* Overlong forms, surrogates and anything past U+10FFFF are all invalid.
+*/
+static unsigned int jswrwriter_utf8decode(const unsigned char * str, const unsigned int size, unsigned long * codepoint)
+{
+    unsigned int len,a;
+    unsigned char low,high;
+    low=0x80;
+    high=0xBF;
+    if (str[0]<0x80)
+    {
+        *codepoint=str[0];
+        return 1;
+    }
+    else if (str[0]>=0xC2 && str[0]<=0xDF)
+    {
+        len=2;
+        *codepoint=str[0] & 0x1F;
+    }
+    else if (str[0]>=0xE0 && str[0]<=0xEF)
+    {
+        len=3;
+        *codepoint=str[0] & 0x0F;
+        if (str[0]==0xE0) low=0xA0;
+        if (str[0]==0xED) high=0x9F;
+    }
+    else if (str[0]>=0xF0 && str[0]<=0xF4)
+    {
+        len=4;
+        *codepoint=str[0] & 0x07;
+        if (str[0]==0xF0) low=0x90;
+        if (str[0]==0xF4) high=0x8F;
+    }
+    else
+        return 0;
+    if (len>size)
+        return 0;
+    for (a=1;a<len;a++)
+    {
+        if (str[a]<low || str[a]>high)
+            return 0;
+        low=0x80;
+        high=0xBF;
+        *codepoint=(*codepoint<<6) | (str[a] & 0x3F);
+    }
+    return len;
+}
+
+static void jswrwriter_writeucode(const unsigned long codepoint, jswrwriter_obj * jswr)
+{
+    static const char hex_digits[]="0123456789abcdef";
+    char ucode_str[6];
+    unsigned long high,low;
+    if (codepoint>=0x10000) //Written as a surrogate pair.
+    {
+        high=0xD800+((codepoint-0x10000)>>10);
+        low=0xDC00+((codepoint-0x10000) & 0x3FF);
+        jswrwriter_writeucode(high, jswr);
+        jswrwriter_writeucode(low, jswr);
+        return;
+    }
+    ucode_str[0]='\\';
+    ucode_str[1]='u';
+    ucode_str[2]=hex_digits[(codepoint>>12) & 0xF];
+    ucode_str[3]=hex_digits[(codepoint>>8) & 0xF];
+    ucode_str[4]=hex_digits[(codepoint>>4) & 0xF];
+    ucode_str[5]=hex_digits[codepoint & 0xF];
+    jswrwriter_putn(ucode_str, 6, jswr);
+}
+
+/*
+* Writes a string with its escapes. The clean runs between the bytes that need escaping are found 16-32 bytes at a time (when SIMD is available), and copied in bulk.
+* Non-ASCII bytes are only looked at when they're escaped or checked as UTF-8, and valid characters stay in the run.
+*/
+static int jswrwriter_writeescaped(const unsigned char * str, const unsigned int size, jswrwriter_obj * jswr)
+{
+    unsigned int a,start,len,stop;
+    unsigned long codepoint;
+    char esc_str[2];
+    stop=0;
+    if (jswr->setting_escape & JSWR_ESCAPE_SLASH)
+        stop|=JSWR_STOP_SLASH;
+    if ((jswr->setting_escape & JSWR_ESCAPE_UNICODE) || jswr->setting_utf8!=JSWR_UTF8_NONE)
+        stop|=JSWR_STOP_HIGH;
+    a=0;
+    start=0;
+    while (a<size)
+    {
+        a+=jswr->wr_scan(str+a, size-a, stop);
+        if (a>=size || str[a]=='\0') //'\0' ends the string.
+            break;
+        if (str[a]<0x80)
+        {
+            jswrwriter_putn((const char *) str+start, a-start, jswr);
+            if (jswrwriter_esctable[str[a]]=='u')
+                jswrwriter_writeucode(str[a], jswr);
+            else
+            {
+                esc_str[0]='\\';
+                esc_str[1]=(char) jswrwriter_esctable[str[a]];
+                jswrwriter_putn(esc_str, 2, jswr);
+            }
+            a++;
+            start=a;
+            continue;
+        }
+        len=jswrwriter_utf8decode(str+a, size-a, &codepoint);
+        if (len>0 && !(jswr->setting_escape & JSWR_ESCAPE_UNICODE))
+        {
+            a+=len;
+            continue;
+        }
+        jswrwriter_putn((const char *) str+start, a-start, jswr);
+        if (len==0)
+        {
+            if (jswr->setting_utf8==JSWR_UTF8_REJECT)
+                return JSWR_ERROR_BADUTF8;
+            len=1;
+            if (jswr->setting_utf8==JSWR_UTF8_NONE)
+            {
+                jswrwriter_putc((char) str[a], jswr);
+                a++;
+                start=a;
+                continue;
+            }
+            codepoint=0xFFFD;
+        }
+        if (jswr->setting_escape & JSWR_ESCAPE_UNICODE)
+            jswrwriter_writeucode(codepoint, jswr);
+        else
+            jswrwriter_putn("\xEF\xBF\xBD", 3, jswr); //Only invalid bytes get here, replaced by U+FFFD.
+        a+=len;
+        start=a;
+    }
+    jswrwriter_putn((const char *) str+start, a-start, jswr);
+    return JSWR_SUCCESS;
+}
+
+static unsigned int jswrwriter_skipspace(const unsigned char * str, unsigned int a, const unsigned int size)
+{
+    while (a<size && (str[a]==' ' || str[a]=='\t' || str[a]=='\n' || str[a]=='\r'))
+        a++;
+    return a;
+}
+
+static int jswrwriter_ishex(const unsigned char c)
+{
+    return (c>='0' && c<='9') || (c>='a' && c<='f') || (c>='A' && c<='F');
+}
+
+/*
+* Checks a string starting at its opening quote, giving back where it ends (past the closing quote), or 0 if it's not valid.
+* The runs between quotes, backslashes and control characters are skipped by the same scan the escaping uses.
+*/
+static unsigned int jswrwriter_checkrawstr(const unsigned char * str, unsigned int a, const unsigned int size, const jswrwriter_obj * jswr)
+{
+    a++;
+    for (;;)
+    {
+        a+=jswr->wr_scan(str+a, size-a, 0);
+        if (a>=size)
+            return 0;
+        if (str[a]=='"')
+            return a+1;
+        if (str[a]!='\\' || a+1>=size)
+            return 0;
+        switch (str[a+1])
+        {
+            case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                a+=2;
+                break;
+            case 'u':
+                if (a+5>=size || !jswrwriter_ishex(str[a+2]) || !jswrwriter_ishex(str[a+3]) || !jswrwriter_ishex(str[a+4]) || !jswrwriter_ishex(str[a+5]))
+                    return 0;
+                a+=6;
+                break;
+            default:
+                return 0;
+        }
+    }
+}
+
+static unsigned int jswrwriter_checkrawnum(const unsigned char * str, unsigned int a, const unsigned int size) //Same as above, for a number.
+{
+    unsigned int start;
+    if (a<size && str[a]=='-')
+        a++;
+    if (a<size && str[a]=='0')
+        a++;
+    else if (a<size && str[a]>='1' && str[a]<='9')
+    {
+        while (a<size && str[a]>='0' && str[a]<='9')
+            a++;
+    }
+    else
+        return 0;
+    if (a<size && str[a]=='.')
+    {
+        start=++a;
+        while (a<size && str[a]>='0' && str[a]<='9')
+            a++;
+        if (a==start)
+            return 0;
+    }
+    if (a<size && (str[a]=='e' || str[a]=='E'))
+    {
+        a++;
+        if (a<size && (str[a]=='+' || str[a]=='-'))
+            a++;
+        start=a;
+        while (a<size && str[a]>='0' && str[a]<='9')
+            a++;
+        if (a==start)
+            return 0;
+    }
+    return a;
+}
+
+static unsigned int jswrwriter_checkrawkey(const unsigned char * str, unsigned int a, const unsigned int size, const jswrwriter_obj * jswr) //Checks a key and its colon, giving back where its value starts.
+{
+    if (a>=size || str[a]!='"')
+        return 0;
+    a=jswrwriter_checkrawstr(str, a, size, jswr);
+    if (a==0)
+        return 0;
+    a=jswrwriter_skipspace(str, a, size);
+    if (a>=size || str[a]!=':')
+        return 0;
+    return jswrwriter_skipspace(str, a+1, size);
+}
+
+/*
+* Checks that raw JSON is exactly one well-formed value (whitespace around it is fine), without building anything.
+* The nesting is kept one bit per level, like the writer's own, and held to the same max depth.
+*/
+static int jswrwriter_checkraw(const unsigned char * str, const unsigned int size, const jswrwriter_obj * jswr)
+{
+    unsigned char level_bits[(JSWR_MAX_DEPTH+7)/8];
+    unsigned int a,level;
+    unsigned char is_array;
+    level=0;
+    a=jswrwriter_skipspace(str, 0, size);
+    for (;;)
+    {
+        if (a>=size) //A value is expected at a.
+            return 0;
+        if (str[a]=='{' || str[a]=='[')
+        {
+            if (level>=jswr->setting_maxdepth)
+                return 0;
+            is_array=str[a]=='[';
+            if (is_array)
+                level_bits[level>>3]|=(unsigned char) (1<<(level & 7));
+            else
+                level_bits[level>>3]&=(unsigned char) ~(1<<(level & 7));
+            level++;
+            a=jswrwriter_skipspace(str, a+1, size);
+            if (a>=size)
+                return 0;
+            if (str[a]!=(is_array ? ']' : '}'))
+            {
+                if (!is_array)
+                {
+                    a=jswrwriter_checkrawkey(str, a, size, jswr);
+                    if (a==0)
+                        return 0;
+                }
+                continue;
+            }
+            a++;
+            level--;
+        }
+        else if (str[a]=='"')
+            a=jswrwriter_checkrawstr(str, a, size, jswr);
+        else if (str[a]=='t' || str[a]=='f' || str[a]=='n')
+        {
+            if (size-a>=4 && (memcmp(str+a, "true", 4)==0 || memcmp(str+a, "null", 4)==0))
+                a+=4;
+            else if (size-a>=5 && memcmp(str+a, "false", 5)==0)
+                a+=5;
+            else
+                return 0;
+        }
+        else
+            a=jswrwriter_checkrawnum(str, a, size);
+        if (a==0)
+            return 0;
+        for (;;) //After a value, there can be closings, then a comma or the end.
+        {
+            a=jswrwriter_skipspace(str, a, size);
+            if (level==0)
+                return a==size;
+            if (a>=size)
+                return 0;
+            is_array=(level_bits[(level-1)>>3] & (1<<((level-1) & 7)))!=0;
+            if (str[a]==',')
+                break;
+            if (str[a]!=(is_array ? ']' : '}'))
+                return 0;
+            a++;
+            level--;
+        }
+        a=jswrwriter_skipspace(str, a+1, size);
+        if (!is_array)
+        {
+            a=jswrwriter_checkrawkey(str, a, size, jswr);
+            if (a==0)
+                return 0;
+        }
+    }
+}
+
+static int jswrwriter_writeraw(const unsigned char * str, unsigned int size, jswrwriter_obj * jswr) //Copied as-is, though a '\0' still ends it like any other string.
+{
+    const unsigned char * end;
+    end=(const unsigned char *) memchr(str, '\0', size);
+    if (end!=NULL)
+        size=(unsigned int) (end-str);
+    if (jswr->setting_rawcheck && !jswrwriter_checkraw(str, size, jswr))
+        return JSWR_ERROR_BADRAW;
+    jswrwriter_putn((const char *) str, size, jswr);
+    return JSWR_SUCCESS;
+}
+
+static const char jswrwriter_digitpairs[201]=
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static unsigned int jswrwriter_countdigits(const unsigned int num)
+{
+    if (num<10) return 1;
+    if (num<100) return 2;
+    if (num<1000) return 3;
+    if (num<10000) return 4;
+    if (num<100000) return 5;
+    if (num<1000000) return 6;
+    if (num<10000000) return 7;
+    if (num<100000000) return 8;
+    if (num<1000000000) return 9;
+    return 10;
+}
+
+/*
+* Writes an integer straight into the string data, two digits at a time from the end, without sprintf (or the locale).
+*/
+static void jswrwriter_writeuint(unsigned int num, const unsigned int negative, jswrwriter_obj * jswr)
+{
+    unsigned int len,pos,pair;
+    char * out;
+    len=jswrwriter_countdigits(num)+negative;
+    if (jswr->wr_measure)
+    {
+        jswr->wr_measured+=len;
+        return;
+    }
+    if (jswr->wr_strsize+len>=jswr->wr_strcap)
+        jswrwriter_growstr(len, jswr);
+    out=jswr->wr_str+jswr->wr_strsize;
+    if (negative)
+        out[0]='-';
+    pos=len;
+    while (num>=100)
+    {
+        pair=(num%100)*2;
+        num/=100;
+        out[--pos]=jswrwriter_digitpairs[pair+1];
+        out[--pos]=jswrwriter_digitpairs[pair];
+    }
+    if (num>=10)
+    {
+        out[--pos]=jswrwriter_digitpairs[num*2+1];
+        out[--pos]=jswrwriter_digitpairs[num*2];
+    }
+    else
+        out[--pos]=(char) ('0'+num);
+    jswr->wr_strsize+=len;
+    jswr->wr_str[jswr->wr_strsize]='\0';
+}
+
+static void jswrwriter_writeint(const int num, jswrwriter_obj * jswr)
+{
+    if (num<0)
+        jswrwriter_writeuint(0u-(unsigned int) num, 1, jswr);
+    else
+        jswrwriter_writeuint((unsigned int) num, 0, jswr);
+}
+
+/*
+* Puts a 64-bit number's digits at the end of out (20 chars), giving back how many there are.
+*/
+static unsigned int jswrwriter_u64digits(jswr_u64 num, char * out)
+{
+    unsigned int pos,pair;
+    pos=20;
+    while (num>=100)
+    {
+        pair=(unsigned int) (num%100)*2;
+        num/=100;
+        out[--pos]=jswrwriter_digitpairs[pair+1];
+        out[--pos]=jswrwriter_digitpairs[pair];
+    }
+    if (num>=10)
+    {
+        out[--pos]=jswrwriter_digitpairs[num*2+1];
+        out[--pos]=jswrwriter_digitpairs[num*2];
+    }
+    else
+        out[--pos]=(char) ('0'+num);
+    return 20-pos;
+}
+
+/*
+* Numbers that fit in 32 bits take the usual path.
+*/
+static void jswrwriter_writeuint64(const jswr_u64 num, const unsigned int negative, jswrwriter_obj * jswr)
+{
+    char num_str[20];
+    unsigned int len;
+    if (num<=0xFFFFFFFFu)
+    {
+        jswrwriter_writeuint((unsigned int) num, negative, jswr);
+        return;
+    }
+    len=jswrwriter_u64digits(num, num_str);
+    if (negative)
+        jswrwriter_putc('-', jswr);
+    jswrwriter_putn(num_str+20-len, len, jswr);
+}
+
+static void jswrwriter_writeint64(const jswr_i64 num, jswrwriter_obj * jswr)
+{
+    if (num<0)
+        jswrwriter_writeuint64(0-(jswr_u64) num, 1, jswr);
+    else
+        jswrwriter_writeuint64((jswr_u64) num, 0, jswr);
+}
+
+typedef struct jswrdiyfp
+{
+    jswr_u64 f;
+    int e;
+} jswrdiyfp_t;
+
+static const jswr_u64 jswrwriter_pow10[20]=
+{
+    JSWR_U64_C(1), JSWR_U64_C(10), JSWR_U64_C(100), JSWR_U64_C(1000), JSWR_U64_C(10000),
+    JSWR_U64_C(100000), JSWR_U64_C(1000000), JSWR_U64_C(10000000), JSWR_U64_C(100000000), JSWR_U64_C(1000000000),
+    JSWR_U64_C(10000000000), JSWR_U64_C(100000000000), JSWR_U64_C(1000000000000), JSWR_U64_C(10000000000000), JSWR_U64_C(100000000000000),
+    JSWR_U64_C(1000000000000000), JSWR_U64_C(10000000000000000), JSWR_U64_C(100000000000000000), JSWR_U64_C(1000000000000000000), JSWR_U64_C(10000000000000000000)
+};
+
+/*
+* Normalized 10^k for k = -348, -340, ..., 340, as significands and binary exponents.
+*/
+static const jswr_u64 jswrwriter_cachedpowers_f[87]=
+{
+    JSWR_U64_C(0xfa8fd5a0081c0288), JSWR_U64_C(0xbaaee17fa23ebf76), JSWR_U64_C(0x8b16fb203055ac76), JSWR_U64_C(0xcf42894a5dce35ea),
+    JSWR_U64_C(0x9a6bb0aa55653b2d), JSWR_U64_C(0xe61acf033d1a45df), JSWR_U64_C(0xab70fe17c79ac6ca), JSWR_U64_C(0xff77b1fcbebcdc4f),
+    JSWR_U64_C(0xbe5691ef416bd60c), JSWR_U64_C(0x8dd01fad907ffc3c), JSWR_U64_C(0xd3515c2831559a83), JSWR_U64_C(0x9d71ac8fada6c9b5),
+    JSWR_U64_C(0xea9c227723ee8bcb), JSWR_U64_C(0xaecc49914078536d), JSWR_U64_C(0x823c12795db6ce57), JSWR_U64_C(0xc21094364dfb5637),
+    JSWR_U64_C(0x9096ea6f3848984f), JSWR_U64_C(0xd77485cb25823ac7), JSWR_U64_C(0xa086cfcd97bf97f4), JSWR_U64_C(0xef340a98172aace5),
+    JSWR_U64_C(0xb23867fb2a35b28e), JSWR_U64_C(0x84c8d4dfd2c63f3b), JSWR_U64_C(0xc5dd44271ad3cdba), JSWR_U64_C(0x936b9fcebb25c996),
+    JSWR_U64_C(0xdbac6c247d62a584), JSWR_U64_C(0xa3ab66580d5fdaf6), JSWR_U64_C(0xf3e2f893dec3f126), JSWR_U64_C(0xb5b5ada8aaff80b8),
+    JSWR_U64_C(0x87625f056c7c4a8b), JSWR_U64_C(0xc9bcff6034c13053), JSWR_U64_C(0x964e858c91ba2655), JSWR_U64_C(0xdff9772470297ebd),
+    JSWR_U64_C(0xa6dfbd9fb8e5b88f), JSWR_U64_C(0xf8a95fcf88747d94), JSWR_U64_C(0xb94470938fa89bcf), JSWR_U64_C(0x8a08f0f8bf0f156b),
+    JSWR_U64_C(0xcdb02555653131b6), JSWR_U64_C(0x993fe2c6d07b7fac), JSWR_U64_C(0xe45c10c42a2b3b06), JSWR_U64_C(0xaa242499697392d3),
+    JSWR_U64_C(0xfd87b5f28300ca0e), JSWR_U64_C(0xbce5086492111aeb), JSWR_U64_C(0x8cbccc096f5088cc), JSWR_U64_C(0xd1b71758e219652c),
+    JSWR_U64_C(0x9c40000000000000), JSWR_U64_C(0xe8d4a51000000000), JSWR_U64_C(0xad78ebc5ac620000), JSWR_U64_C(0x813f3978f8940984),
+    JSWR_U64_C(0xc097ce7bc90715b3), JSWR_U64_C(0x8f7e32ce7bea5c70), JSWR_U64_C(0xd5d238a4abe98068), JSWR_U64_C(0x9f4f2726179a2245),
+    JSWR_U64_C(0xed63a231d4c4fb27), JSWR_U64_C(0xb0de65388cc8ada8), JSWR_U64_C(0x83c7088e1aab65db), JSWR_U64_C(0xc45d1df942711d9a),
+    JSWR_U64_C(0x924d692ca61be758), JSWR_U64_C(0xda01ee641a708dea), JSWR_U64_C(0xa26da3999aef774a), JSWR_U64_C(0xf209787bb47d6b85),
+    JSWR_U64_C(0xb454e4a179dd1877), JSWR_U64_C(0x865b86925b9bc5c2), JSWR_U64_C(0xc83553c5c8965d3d), JSWR_U64_C(0x952ab45cfa97a0b3),
+    JSWR_U64_C(0xde469fbd99a05fe3), JSWR_U64_C(0xa59bc234db398c25), JSWR_U64_C(0xf6c69a72a3989f5c), JSWR_U64_C(0xb7dcbf5354e9bece),
+    JSWR_U64_C(0x88fcf317f22241e2), JSWR_U64_C(0xcc20ce9bd35c78a5), JSWR_U64_C(0x98165af37b2153df), JSWR_U64_C(0xe2a0b5dc971f303a),
+    JSWR_U64_C(0xa8d9d1535ce3b396), JSWR_U64_C(0xfb9b7cd9a4a7443c), JSWR_U64_C(0xbb764c4ca7a44410), JSWR_U64_C(0x8bab8eefb6409c1a),
+    JSWR_U64_C(0xd01fef10a657842c), JSWR_U64_C(0x9b10a4e5e9913129), JSWR_U64_C(0xe7109bfba19c0c9d), JSWR_U64_C(0xac2820d9623bf429),
+    JSWR_U64_C(0x80444b5e7aa7cf85), JSWR_U64_C(0xbf21e44003acdd2d), JSWR_U64_C(0x8e679c2f5e44ff8f), JSWR_U64_C(0xd433179d9c8cb841),
+    JSWR_U64_C(0x9e19db92b4e31ba9), JSWR_U64_C(0xeb96bf6ebadf77d9), JSWR_U64_C(0xaf87023b9bf0ee6b)
+};
+
+static const short jswrwriter_cachedpowers_e[87]=
+{
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static jswrdiyfp_t jswrwriter_diyfp(const jswr_u64 f, const int e)
+{
+    jswrdiyfp_t fp;
+    fp.f=f;
+    fp.e=e;
+    return fp;
+}
+
+static jswrdiyfp_t jswrwriter_diyfp_mul(const jswrdiyfp_t x, const jswrdiyfp_t y) //The upper 64 bits of the product, rounded.
+{
+    jswr_u64 a,b,c,d,ac,bc,ad,bd,tmp;
+    a=x.f>>32;
+    b=x.f & 0xFFFFFFFF;
+    c=y.f>>32;
+    d=y.f & 0xFFFFFFFF;
+    ac=a*c;
+    bc=b*c;
+    ad=a*d;
+    bd=b*d;
+    tmp=(bd>>32)+(ad & 0xFFFFFFFF)+(bc & 0xFFFFFFFF);
+    tmp+=(jswr_u64) 1<<31;
+    return jswrwriter_diyfp(ac+(ad>>32)+(bc>>32)+(tmp>>32), x.e+y.e+64);
+}
+
+static jswrdiyfp_t jswrwriter_diyfp_normalize(jswrdiyfp_t fp)
+{
+    while (!(fp.f & ((jswr_u64) 1<<63)))
+    {
+        fp.f<<=1;
+        fp.e-=1;
+    }
+    return fp;
+}
+
+static void jswrwriter_grisu_round(char * buffer, const int len, const jswr_u64 delta, jswr_u64 rest, const jswr_u64 ten_kappa, const jswr_u64 wp_w)
+{
+    while (rest<wp_w && delta-rest>=ten_kappa && (rest+ten_kappa<wp_w || wp_w-rest>rest+ten_kappa-wp_w))
+    {
+        buffer[len-1]--;
+        rest+=ten_kappa;
+    }
+}
+
+static void jswrwriter_grisu_digits(const jswrdiyfp_t w, const jswrdiyfp_t mp, jswr_u64 delta, char * buffer, int * len, int * k)
+{
+    jswrdiyfp_t one;
+    jswr_u64 wp_w,p2,tmp;
+    unsigned int p1,d;
+    int kappa;
+    one=jswrwriter_diyfp((jswr_u64) 1<<-mp.e, mp.e);
+    wp_w=mp.f-w.f;
+    p1=(unsigned int) (mp.f>>-one.e);
+    p2=mp.f & (one.f-1);
+    kappa=(int) jswrwriter_countdigits(p1);
+    *len=0;
+    while (kappa>0)
+    {
+        d=p1/(unsigned int) jswrwriter_pow10[kappa-1];
+        p1%=(unsigned int) jswrwriter_pow10[kappa-1];
+        if (d || *len)
+            buffer[(*len)++]=(char) ('0'+d);
+        kappa--;
+        tmp=((jswr_u64) p1<<-one.e)+p2;
+        if (tmp<=delta)
+        {
+            *k+=kappa;
+            jswrwriter_grisu_round(buffer, *len, delta, tmp, jswrwriter_pow10[kappa]<<-one.e, wp_w);
+            return;
+        }
+    }
+    for (;;)
+    {
+        p2*=10;
+        delta*=10;
+        d=(unsigned int) (p2>>-one.e);
+        if (d || *len)
+            buffer[(*len)++]=(char) ('0'+d);
+        p2&=one.f-1;
+        kappa--;
+        if (p2<delta)
+        {
+            *k+=kappa;
+            jswrwriter_grisu_round(buffer, *len, delta, p2, one.f, -kappa<20 ? wp_w*jswrwriter_pow10[-kappa] : 0);
+            return;
+        }
+    }
+}
+
+/*
+* Grisu2: finds the shortest digits (in all but rare cases) that read back as the same value, for a number f * 2^e.
+* lower_closer is set when f is a power of two, so the next value down is only half as far away.
+* The value is digits * 10^k. Works for both doubles and floats, since only the rounding boundaries differ.
+*/
+static void jswrwriter_grisu2(const jswr_u64 f, const int e, const int lower_closer, char * buffer, int * len, int * k)
+{
+    jswrdiyfp_t w,w_plus,w_minus,c_mk;
+    double dk;
+    int cached_k,index;
+    w_plus=jswrwriter_diyfp_normalize(jswrwriter_diyfp((f<<1)+1, e-1));
+    if (lower_closer)
+        w_minus=jswrwriter_diyfp((f<<2)-1, e-2);
+    else
+        w_minus=jswrwriter_diyfp((f<<1)-1, e-1);
+    w_minus.f<<=w_minus.e-w_plus.e;
+    w_minus.e=w_plus.e;
+    dk=(-61-w_plus.e)*0.30102999566398114+347; //Picks a cached power so the scaled exponent lands in [-60,-32].
+    cached_k=(int) dk;
+    if (dk-cached_k>0.0)
+        cached_k++;
+    index=(cached_k>>3)+1;
+    *k=-(-348+index*8);
+    c_mk=jswrwriter_diyfp(jswrwriter_cachedpowers_f[index], jswrwriter_cachedpowers_e[index]);
+    w=jswrwriter_diyfp_mul(jswrwriter_diyfp_normalize(jswrwriter_diyfp(f, e)), c_mk);
+    w_plus=jswrwriter_diyfp_mul(w_plus, c_mk);
+    w_minus=jswrwriter_diyfp_mul(w_minus, c_mk);
+    w_minus.f++;
+    w_plus.f--;
+    jswrwriter_grisu_digits(w, w_plus, w_plus.f-w_minus.f, buffer, len, k);
+}
+
+/*
+* Lays out digits * 10^k like JavaScript does: plain decimals from 1e-6 up to 1e21, exponents outside of that.
+*/
+static unsigned int jswrwriter_layoutdigits(char * out, const char * digits, const int len, const int k)
+{
+    int n,a,pos;
+    unsigned int exp_num;
+    n=len+k; //Where the decimal point goes.
+    pos=0;
+    if (len<=n && n<=21)
+    {
+        memcpy(out, digits, len);
+        for (a=len;a<n;a++)
+            out[a]='0';
+        return (unsigned int) n;
+    }
+    if (0<n && n<=21)
+    {
+        memcpy(out, digits, n);
+        out[n]='.';
+        memcpy(out+n+1, digits+n, len-n);
+        return (unsigned int) len+1;
+    }
+    if (-6<n && n<=0)
+    {
+        out[0]='0';
+        out[1]='.';
+        for (a=0;a<-n;a++)
+            out[2+a]='0';
+        memcpy(out+2-n, digits, len);
+        return (unsigned int) (2-n+len);
+    }
+    out[pos++]=digits[0];
+    if (len>1)
+    {
+        out[pos++]='.';
+        memcpy(out+pos, digits+1, len-1);
+        pos+=len-1;
+    }
+    out[pos++]='e';
+    out[pos++]=(n-1<0) ? '-' : '+';
+    exp_num=(unsigned int) (n-1<0 ? 1-n : n-1);
+    if (exp_num>=100)
+        out[pos++]=(char) ('0'+exp_num/100);
+    if (exp_num>=10)
+        out[pos++]=(char) ('0'+exp_num/10%10);
+    out[pos++]=(char) ('0'+exp_num%10);
+    return (unsigned int) pos;
+}
+
+static int jswrwriter_writenonfinite(const int is_nan, const int negative, jswrwriter_obj * jswr)
+{
+    switch (jswr->setting_nonfinite)
+    {
+        case JSWR_NONFINITE_STRING:
+            if (is_nan)
+                jswrwriter_puts("\"NaN\"", jswr);
+            else if (negative)
+                jswrwriter_puts("\"-Infinity\"", jswr);
+            else
+                jswrwriter_puts("\"Infinity\"", jswr);
+            break;
+        case JSWR_NONFINITE_ERROR:
+            return JSWR_ERROR_NONFINITE;
+        default:
+            jswrwriter_puts("null", jswr);
+            break;
+    }
+    return JSWR_SUCCESS;
+}
+
+/*
+* Writes a double, or a float when is_float is set, with the shortest digits that read back as the same value.
+* No sprintf, so the locale can't swap in a comma.
+*/
+static int jswrwriter_writedouble(const double num, const int is_float, jswrwriter_obj * jswr)
+{
+    char digits[24];
+    char num_str[32];
+    jswr_u64 bits,f;
+    unsigned int float_bits,biased_e;
+    int e,len,k,negative,lower_closer;
+    unsigned int pos;
+    float num_single;
+    if (is_float)
+    {
+        num_single=(float) num;
+        memcpy(&float_bits, &num_single, sizeof(float_bits));
+        negative=(float_bits>>31)!=0;
+        biased_e=(float_bits>>23) & 0xFF;
+        f=float_bits & 0x7FFFFF;
+        if (biased_e==0xFF)
+            return jswrwriter_writenonfinite(f!=0, negative, jswr);
+        lower_closer=(f==0 && biased_e>1);
+        if (biased_e!=0)
+        {
+            f+=0x800000;
+            e=(int) biased_e-150;
+        }
+        else
+            e=-149;
+    }
+    else
+    {
+        memcpy(&bits, &num, sizeof(bits));
+        negative=(bits>>63)!=0;
+        biased_e=(unsigned int) (bits>>52) & 0x7FF;
+        f=bits & ((((jswr_u64) 1)<<52)-1);
+        if (biased_e==0x7FF)
+            return jswrwriter_writenonfinite(f!=0, negative, jswr);
+        lower_closer=(f==0 && biased_e>1);
+        if (biased_e!=0)
+        {
+            f+=((jswr_u64) 1)<<52;
+            e=(int) biased_e-1075;
+        }
+        else
+            e=-1074;
+    }
+    pos=0;
+    if (negative)
+        num_str[pos++]='-';
+    if (f==0)
+        num_str[pos++]='0';
+    else
+    {
+        jswrwriter_grisu2(f, e, lower_closer, digits, &len, &k);
+        pos+=jswrwriter_layoutdigits(num_str+pos, digits, len, k);
+    }
+    jswrwriter_putn(num_str, pos, jswr);
+    return JSWR_SUCCESS;
+}
+
+static int jswrwriter_writekey(const jswrtok_t * tok, const int with_colon, jswrwriter_obj * jswr);
+
+static int jswrwriter_writetoken(const jswrtok_t * tok, jswrwriter_obj * jswr)
+{
+    int error_type;
+    error_type=JSWR_SUCCESS;
+            switch(tok->tok_type)
+            {
+
+            case JSWR_TOKEN_KEY:
+            case JSWR_TOKEN_KEYREF:
+                error_type=jswrwriter_writekey(tok, 0, jswr);
+                break;
+
+            case JSWR_TOKEN_STRING:
+                jswrwriter_putc('"',jswr);
+                error_type=jswrwriter_writeescaped(tok->str, tok->str_size, jswr);
+                jswrwriter_putc('"',jswr);
+                break;
+
+            case JSWR_TOKEN_BOOL: //NEW!
+				if (tok->num_int)
+					jswrwriter_puts("true",jswr);
+				else
+					jswrwriter_puts("false",jswr);
+                break;
+
+			case JSWR_TOKEN_TRUE:
+                jswrwriter_puts("true",jswr);
+                break;
+
+            case JSWR_TOKEN_FALSE:
+                jswrwriter_puts("false",jswr);
+                break;
+
+            case JSWR_TOKEN_NULL:
+                jswrwriter_puts("null",jswr);
+                break;
+
+            case JSWR_TOKEN_INT:
+                jswrwriter_writeint(tok->num_int, jswr);
+                break;
+
+            case JSWR_TOKEN_UINT:
+                jswrwriter_writeuint((unsigned int) tok->num_int, 0, jswr);
+                break;
+
+            case JSWR_TOKEN_INT64:
+                jswrwriter_writeint64((jswr_i64) tok->num_long, jswr);
+                break;
+
+            case JSWR_TOKEN_UINT64:
+                jswrwriter_writeuint64(tok->num_long, 0, jswr);
+                break;
+
+            case JSWR_TOKEN_FLOAT:
+                error_type=jswrwriter_writedouble(tok->num_double, 1, jswr);
+                break;
+
+            case JSWR_TOKEN_UFLOAT:
+                error_type=jswrwriter_writedouble(tok->num_double, 1, jswr);
+                break;
+
+            case JSWR_TOKEN_DOUBLE:
+                error_type=jswrwriter_writedouble(tok->num_double, 0, jswr);
+                break;
+
+            case JSWR_TOKEN_RAW:
+                error_type=jswrwriter_writeraw(tok->str, tok->str_size, jswr);
+                break;
+
+            default:
+                jswrwriter_puts("\"???\"",jswr);
+                break;
+            }
+    return error_type;
+}
+
+/*
+* Writes a cached value. Beautified ones are kept as written at level 0, so each of their lines is indented by level here.
+*/
+static void jswrwriter_writecached(const jswrtok_t * tok, const int level, jswrwriter_obj * jswr)
+{
+    const unsigned char * str;
+    const unsigned char * end;
+    const unsigned char * line_end;
+    str=tok->str;
+    end=tok->str+tok->str_size;
+    if (!jswr->setting_uselines || level==0)
+    {
+        jswrwriter_putn((const char *) str, tok->str_size, jswr);
+        return;
+    }
+    while ((line_end=(const unsigned char *) memchr(str, '\n', (size_t) (end-str)))!=NULL)
+    {
+        jswrwriter_putn((const char *) str, (unsigned int) (line_end-str)+1, jswr);
+        jswrwriter_writeindent(level, 0, jswr);
+        str=line_end+1;
+    }
+    jswrwriter_putn((const char *) str, (unsigned int) (end-str), jswr);
+}
+
+/*
+* Writes an interned (or escaped ahead of time) key, copied in one go when it was escaped the same way the writer escapes.
+* Otherwise it's escaped again here, so it always comes out the same as its string.
+*/
+static int jswrwriter_writekey(const jswrtok_t * tok, const int with_colon, jswrwriter_obj * jswr)
+{
+    const jswrkeys_t * keys;
+    const jswrkey_t * key;
+    const char * raw,* escaped;
+    unsigned int raw_size,escaped_size;
+    jswrtok_t str_tok;
+    int error_type;
+    if (tok->tok_type==JSWR_TOKEN_KEYREF)
+    {
+        raw=(const char *) tok->str;
+        raw_size=tok->str_size;
+        escaped=raw+raw_size;
+        escaped_size=(unsigned int) tok->num_int;
+        if (escaped_size==0) //Turned away by jswrwriter_gen_key_ref().
+            return JSWR_ERROR_BADKEY;
+    }
+    else
+    {
+        keys=(const jswrkeys_t *) tok->str; //Keys carry their table in place of string data.
+        if (keys==NULL || tok->str_size>=keys->key_count)
+            return JSWR_ERROR_BADKEY;
+        key=&keys->keys[tok->str_size];
+        raw=keys->str+key->raw_start;
+        raw_size=key->raw_size;
+        escaped=keys->str+key->esc_start;
+        escaped_size=key->esc_size;
+    }
+    if (jswr->setting_escape==JSWR_ESCAPE_DEFAULT && jswr->setting_utf8==JSWR_UTF8_NONE)
+    {
+        jswrwriter_putn(escaped, with_colon ? escaped_size : escaped_size-2, jswr);
+        return JSWR_SUCCESS;
+    }
+    str_tok.tok_type=JSWR_TOKEN_STRING;
+    str_tok.str=(const unsigned char *) raw;
+    str_tok.str_size=raw_size;
+    error_type=jswrwriter_writetoken(&str_tok, jswr);
+    if (with_colon)
+        jswrwriter_putn(": ", 2, jswr);
+    return error_type;
+}
+
+JSWR_API void jswrwriter_keys_init(jswrkeys_t * keys)
+{
+    keys->str=NULL;
+    keys->str_size=0;
+    keys->str_cap=0;
+    keys->keys=NULL;
+    keys->key_count=0;
+    keys->key_cap=0;
+}
+
+JSWR_API void jswrwriter_keys_free(jswrkeys_t * keys)
+{
+    free(keys->str);
+    free(keys->keys);
+    jswrwriter_keys_init(keys);
+}
+
+/*
+* The key is kept as it is (for writers with other escape settings), and then escaped with the default settings,
+* by the same escaping strings get, on a writer of its own.
+*/
+JSWR_API unsigned int jswrwriter_keys_add(const char * key, const unsigned int key_size, jswrkeys_t * keys)
+{
+    jswrwriter_obj escaper;
+    jswrtok_t str_tok;
+    jswrkey_t * entry;
+    jswrwriter_init(&escaper);
+    str_tok.tok_type=JSWR_TOKEN_STRING;
+    str_tok.str=(const unsigned char *) key;
+    str_tok.str_size=key_size;
+    jswrwriter_writetoken(&str_tok, &escaper);
+    jswrwriter_putn(": ", 2, &escaper);
+    if (keys->key_count>=keys->key_cap)
+    {
+        keys->key_cap=keys->key_cap ? keys->key_cap*2 : 16;
+        keys->keys=(jswrkey_t *) realloc(keys->keys, sizeof(jswrkey_t) * keys->key_cap);
+    }
+    if (keys->str_size+key_size+escaper.wr_strsize>keys->str_cap)
+    {
+        if (keys->str_cap==0)
+            keys->str_cap=256;
+        while (keys->str_size+key_size+escaper.wr_strsize>keys->str_cap)
+            keys->str_cap*=2;
+        keys->str=(char *) realloc(keys->str, sizeof(char) * keys->str_cap);
+    }
+    entry=&keys->keys[keys->key_count];
+    entry->raw_start=keys->str_size;
+    entry->raw_size=key_size;
+    memcpy(keys->str+keys->str_size, key, key_size);
+    keys->str_size+=key_size;
+    entry->esc_start=keys->str_size;
+    entry->esc_size=escaper.wr_strsize;
+    memcpy(keys->str+keys->str_size, escaper.wr_str, escaper.wr_strsize);
+    keys->str_size+=escaper.wr_strsize;
+    jswrwriter_free(&escaper);
+    return keys->key_count++;
+}
+
+JSWR_API void jswrwriter_set_keys(jswrkeys_t * keys, jswrwriter_obj * jswr)
+{
+    jswr->wr_keys=keys;
+}
+
+JSWR_API void jswrwriter_gen_key(const unsigned int handle, jswrwriter_obj * jswr)
+{
+    jswrtok_t * tok;
+    tok=jswrwriter_gen_x(JSWR_TOKEN_KEY, jswr);
+    tok->str=(const unsigned char *) jswr->wr_keys;
+    tok->str_size=handle;
+    jswrwriter_gen_end(jswr);
+    return;
+}
+
+JSWR_API void jswrwriter_gen_key_ref(const char * key, const unsigned int key_size, const unsigned int escaped_size, jswrwriter_obj * jswr)
+{
+    jswrtok_t * tok;
+    const char * escaped;
+    escaped=key+key_size;
+    tok=jswrwriter_gen_x(JSWR_TOKEN_KEYREF, jswr);
+    tok->str=(const unsigned char *) key;
+    tok->str_size=key_size;
+    tok->num_int=(int) escaped_size;
+    if (escaped_size<4 || escaped[0]!='"' || memcmp(escaped+escaped_size-3, "\": ", 3)!=0) //At least "": , or the ": " would be cut off the wrong bytes.
+        tok->num_int=0;
+    jswrwriter_gen_end(jswr);
+    return;
+}
+
+static void jswrwriter_gen_structx(const void * data, const jswrstruct_t * desc, const int borrow, jswrwriter_obj * jswr)
+{
+    jswrtok_t * tok;
+    jswrstructref_t stream_ref;
+    jswrstructref_t * ref;
+    unsigned char * data_copy;
+    const char * str;
+    char * str_copy;
+    unsigned int i,size;
+    tok=jswrwriter_gen_x(JSWR_TOKEN_STRUCT, jswr);
+    tok->str_size=desc->field_count;
+    if (jswr->wr_streaming) //Written before the call returns, so nothing has to be kept.
+    {
+        stream_ref.desc=desc;
+        stream_ref.data=data;
+        tok->str=(const unsigned char *) &stream_ref;
+        jswrwriter_gen_end(jswr);
+        return;
+    }
+    ref=(jswrstructref_t *) jswrwriter_arena_alloc(sizeof(jswrstructref_t), 8, jswr);
+    ref->desc=desc;
+    ref->data=data;
+    if (!borrow)
+    {
+        data_copy=jswrwriter_arena_alloc(desc->struct_size, 8, jswr);
+        memcpy(data_copy,data,desc->struct_size);
+        for (i=0;i<desc->field_count;i++) //Strings are copied too, and pointed at from the copy.
+        {
+            if (desc->fields[i].field_type!=JSWR_FIELD_STRING)
+                continue;
+            memcpy(&str,data_copy+desc->fields[i].offset,sizeof(str));
+            if (str==NULL)
+                continue;
+            size=(unsigned int) strlen(str);
+            str_copy=(char *) jswrwriter_arena_alloc(size+1, 1, jswr);
+            memcpy(str_copy,str,size+1);
+            memcpy(data_copy+desc->fields[i].offset,&str_copy,sizeof(str_copy));
+        }
+        ref->data=data_copy;
+    }
+    tok->str=(const unsigned char *) ref;
+    jswrwriter_gen_end(jswr);
+}
+
+JSWR_API void jswrwriter_gen_struct(const void * data, const jswrstruct_t * desc, jswrwriter_obj * jswr)
+{
+    jswrwriter_gen_structx(data, desc, 0, jswr);
+    return;
+}
+
+JSWR_API void jswrwriter_gen_struct_ref(const void * data, const jswrstruct_t * desc, jswrwriter_obj * jswr)
+{
+    jswrwriter_gen_structx(data, desc, 1, jswr);
+    return;
+}
+
+static void jswrwriter_writebulksep(const unsigned int i, const unsigned int group, const int level, jswrwriter_obj * jswr) //Writes what goes before item i of a bulk array.
+{
+    if (jswr->setting_uselines && group>0 && i%group==0)
+    {
+        if (i>0)
+            jswrwriter_putc(',', jswr);
+        jswrwriter_writeindent(level+1, 1, jswr);
+    }
+    else if (i>0)
+        jswrwriter_putn(", ", 2, jswr);
+}
+
+/*
+* Writes a whole bulk array in one loop, brackets included.
+* The items are indented one past level, the same as if each had been its own command.
+*/
+static int jswrwriter_writebulk(const jswrtok_t * tok, const int level, jswrwriter_obj * jswr)
+{
+    unsigned int i,group;
+    int error_type;
+    const char * str;
+    group=(unsigned int) tok->num_int;
+    if (!jswr->wr_streaming && jswr->setting_compact>0 && tok->str_size<=jswr->setting_compact) //Kept on one line, like a compact array generated item by item.
+        group=0;
+    error_type=JSWR_SUCCESS;
+    jswrwriter_putc('[', jswr);
+    for (i=0;i<tok->str_size && error_type==JSWR_SUCCESS;i++)
+    {
+        jswrwriter_writebulksep(i, group, level, jswr);
+        switch (tok->tok_type)
+        {
+            case JSWR_TOKEN_INTARRAY:
+                jswrwriter_writeint(((const int *) tok->str)[i], jswr);
+                break;
+            case JSWR_TOKEN_DOUBLEARRAY:
+                error_type=jswrwriter_writedouble(((const double *) tok->str)[i], 0, jswr);
+                break;
+            case JSWR_TOKEN_BOOLARRAY:
+                if (tok->str[i])
+                    jswrwriter_putn("true", 4, jswr);
+                else
+                    jswrwriter_putn("false", 5, jswr);
+                break;
+            default:
+                str=((const char * const *) tok->str)[i];
+                if (str==NULL)
+                {
+                    jswrwriter_putn("null", 4, jswr);
+                    break;
+                }
+                jswrwriter_putc('"', jswr);
+                error_type=jswrwriter_writeescaped((const unsigned char *) str, (unsigned int) strlen(str), jswr);
+                jswrwriter_putc('"', jswr);
+                break;
+        }
+    }
+    if (jswr->setting_uselines && group>0) //Empty ones too, like an array opened and closed on its own.
+        jswrwriter_writeindent(level, 1, jswr);
+    jswrwriter_putc(']', jswr);
+    return error_type;
+}
+
+/*
+* Writes a whole struct as an object in one loop, with its keys put in as they were made, one member to a line like any object's.
+*/
+static int jswrwriter_writestruct(const jswrtok_t * tok, const int level, jswrwriter_obj * jswr)
+{
+    const jswrstructref_t * ref;
+    const jswrfield_t * field;
+    const unsigned char * data;
+    const char * str;
+    unsigned int i;
+    int error_type;
+    ref=(const jswrstructref_t *) tok->str;
+    data=(const unsigned char *) ref->data;
+    error_type=JSWR_SUCCESS;
+    jswrwriter_putc('{', jswr);
+    for (i=0;i<ref->desc->field_count && error_type==JSWR_SUCCESS;i++)
+    {
+        field=&ref->desc->fields[i];
+        jswrwriter_writebulksep(i, 1, level, jswr);
+        jswrwriter_putn(field->key, field->key_size, jswr);
+        switch (field->field_type)
+        {
+            case JSWR_FIELD_INT:
+                jswrwriter_writeint(*(const int *) (data+field->offset), jswr);
+                break;
+            case JSWR_FIELD_UINT:
+                jswrwriter_writeuint(*(const unsigned int *) (data+field->offset), 0, jswr);
+                break;
+            case JSWR_FIELD_INT64:
+                jswrwriter_writeint64(*(const jswr_i64 *) (data+field->offset), jswr);
+                break;
+            case JSWR_FIELD_UINT64:
+                jswrwriter_writeuint64(*(const jswr_u64 *) (data+field->offset), 0, jswr);
+                break;
+            case JSWR_FIELD_FLOAT:
+                error_type=jswrwriter_writedouble(*(const float *) (data+field->offset), 1, jswr);
+                break;
+            case JSWR_FIELD_DOUBLE:
+                error_type=jswrwriter_writedouble(*(const double *) (data+field->offset), 0, jswr);
+                break;
+            case JSWR_FIELD_BOOL:
+                if (*(const int *) (data+field->offset))
+                    jswrwriter_putn("true", 4, jswr);
+                else
+                    jswrwriter_putn("false", 5, jswr);
+                break;
+            case JSWR_FIELD_STRING:
+                str=*(const char * const *) (data+field->offset);
+                if (str==NULL)
+                {
+                    jswrwriter_putn("null", 4, jswr);
+                    break;
+                }
+                jswrwriter_putc('"', jswr);
+                error_type=jswrwriter_writeescaped((const unsigned char *) str, (unsigned int) strlen(str), jswr);
+                jswrwriter_putc('"', jswr);
+                break;
+            default:
+                jswrwriter_putc('"', jswr);
+                error_type=jswrwriter_writeescaped(data+field->offset, field->size, jswr); //Stops at the '\0', if there is one.
+                jswrwriter_putc('"', jswr);
+                break;
+        }
+    }
+    if (jswr->setting_uselines) //Empty ones too, like an object opened and closed on its own.
+        jswrwriter_writeindent(level, 1, jswr);
+    jswrwriter_putc('}', jswr);
+    return error_type;
+}
+
+static void jswrwriter_initstate(jswrstate_t * st)
+{
+    st->level=0;
+    st->prev_type=JSWR_TOKEN_NONE;
+    st->pos=0;
+    st->prev_key=0;
+    st->prev_break=0;
+    st->need_comma=0;
+    st->is_end=0;
+    st->checked=0;
+    st->compact=0;
+}
+
+static void jswrwriter_pushlevel(const unsigned char level_type, jswrstate_t * st) //The depth has to be checked against the max first.
+{
+    if (level_type==JSWR_LEVEL_ARRAY)
+        st->level_bits[st->level>>3]|=(unsigned char) (1<<(st->level & 7));
+    else
+        st->level_bits[st->level>>3]&=(unsigned char) ~(1<<(st->level & 7));
+    st->level+=1;
+}
+
+static int jswrwriter_toplevel(const jswrstate_t * st) //The type of the innermost level. There has to be one.
+{
+    if (st->level_bits[(st->level-1)>>3] & (1<<((st->level-1) & 7)))
+        return JSWR_LEVEL_ARRAY;
+    return JSWR_LEVEL_OBJ;
+}
+
+/*
+* Checks and writes a single token, carrying the nesting state from token to token.
+* Commas are written before the next item, so no lookahead is needed, which lets the same code serve parsing and streaming.
+* The checks are skipped when st->checked is set, for commands jswrwriter_check already passed as they were generated.
+*/
+static int jswrwriter_emitfragment(const jswrtok_t * tok, jswrstate_t * st, jswrwriter_obj * jswr);
+
+static int jswrwriter_emit(const jswrtok_t * tok, jswrstate_t * st, jswrwriter_obj * jswr)
+{
+    int in_array,error_type;
+    unsigned int beauty_break;
+    if (st->is_end) //Only reachable when streaming, parsing stops at the end of the root data.
+        return JSWR_ERROR_UNEXPECTEDEXTRA;
+    if (tok->tok_type==JSWR_TOKEN_FRAGMENT) //Written command by command, so it comes out just as if they had been generated here.
+        return jswrwriter_emitfragment(tok, st, jswr);
+    in_array=0;
+    error_type=JSWR_SUCCESS;
+    beauty_break=tok->beauty_break || st->compact; //Everything inside a compact array stays on the line.
+    if (st->level>0)
+    {
+        if (jswrwriter_toplevel(st)==JSWR_LEVEL_ARRAY) //General sort of code to tell it's okay to be in arrays without the key, subjected to move around.
+            in_array=1;
+    }
+    if (st->need_comma && jswrwriter_istokenitem(tok->tok_type,1))
+    {
+        if (JSWR_DEBUGPRINT) printf(",\n");
+        jswrwriter_putc(',',jswr);
+        if (!jswr->setting_uselines || st->prev_break || beauty_break) jswrwriter_putc(' ',jswr);
+    }
+    st->need_comma=0;
+
+    switch (tok->tok_type)
+    {
+        default:
+            if (!st->checked && st->level==0 && !jswr->setting_allowrootdata)
+                return JSWR_ERROR_TOKENOUTSIDE;
+            if (in_array)
+            {
+                if (JSWR_DEBUGPRINT) printf("Item %u in Array (%d)\n",st->pos,st->level-1);
+                jswrwriter_writetab(beauty_break,st->level,st,jswr);
+            }
+            else
+            {
+                if (!st->checked && !st->prev_key)
+                {
+                    if (JSWR_DEBUGPRINT) printf("Item %u Problem...\n",st->pos);
+                    return JSWR_ERROR_NOKEY;
+                }
+                st->prev_key=0;
+                if (JSWR_DEBUGPRINT) printf("%u item\n",st->pos);
+            }
+            error_type=jswrwriter_writetoken(tok, jswr);
+            st->need_comma=1;
+        break;
+
+        case JSWR_TOKEN_STRING:
+        case JSWR_TOKEN_KEY:
+        case JSWR_TOKEN_KEYREF:
+            if (!st->checked && st->level==0 && !jswr->setting_allowrootdata)
+                return JSWR_ERROR_TOKENOUTSIDE;
+            if (in_array)
+            {
+                if (JSWR_DEBUGPRINT) printf("Item %u in Array (%d)\n",st->pos,st->level-1);
+                jswrwriter_writetab(beauty_break,st->level,st,jswr);
+                error_type=jswrwriter_writetoken(tok, jswr);
+                st->need_comma=1;
+            }
+            else if (!st->prev_key)
+            {
+                st->prev_key=1;
+                if (JSWR_DEBUGPRINT) printf("%u key-string\n",st->pos);
+                jswrwriter_writetab(beauty_break,st->level,st,jswr);
+                if (tok->tok_type==JSWR_TOKEN_KEY || tok->tok_type==JSWR_TOKEN_KEYREF) //Its ": " is written along with it.
+                    error_type=jswrwriter_writekey(tok, 1, jswr);
+                else
+                {
+                    error_type=jswrwriter_writetoken(tok, jswr);
+                    jswrwriter_puts(": ", jswr);
+                }
+            }
+            else
+            {
+                st->prev_key=0;
+                if (JSWR_DEBUGPRINT) printf("%u string\n",st->pos);
+                error_type=jswrwriter_writetoken(tok, jswr);
+                st->need_comma=1;
+            }
+        break;
+
+        case JSWR_TOKEN_OBJOPEN:
+        case JSWR_TOKEN_ARRAYOPEN:
+            if (!st->checked && (unsigned int) st->level>=jswr->setting_maxdepth)
+                return JSWR_ERROR_TOODEEP;
+            if (!st->prev_key)
+            {
+                if (!st->checked && jswrwriter_istokenitem(st->prev_type,0) && !in_array)
+                    return JSWR_ERROR_INVALBRACKET;
+                jswrwriter_writetab(beauty_break,st->level,st,jswr);
+            }
+            st->prev_key=0;
+            if (tok->tok_type==JSWR_TOKEN_OBJOPEN)
+            {
+                if (JSWR_DEBUGPRINT) printf("Object Opening (%u)\n",st->pos);
+                jswrwriter_pushlevel(JSWR_LEVEL_OBJ, st);
+                jswrwriter_putc('{',jswr);
+            }
+            else
+            {
+                if (JSWR_DEBUGPRINT) printf("Array Opening (%u)\n",st->pos);
+                jswrwriter_pushlevel(JSWR_LEVEL_ARRAY, st);
+                jswrwriter_putc('[',jswr);
+            }
+        break;
+
+        case JSWR_TOKEN_INTARRAY:
+        case JSWR_TOKEN_DOUBLEARRAY:
+        case JSWR_TOKEN_BOOLARRAY:
+        case JSWR_TOKEN_STRINGARRAY: //Checked like an array opening and closing in one.
+        case JSWR_TOKEN_STRUCT: //And so are structs, as objects.
+            if (!st->prev_key)
+            {
+                if (!st->checked && jswrwriter_istokenitem(st->prev_type,0) && !in_array)
+                    return JSWR_ERROR_INVALBRACKET;
+                jswrwriter_writetab(beauty_break,st->level,st,jswr);
+            }
+            st->prev_key=0;
+            if (JSWR_DEBUGPRINT) printf("Bulk Array (%u)\n",st->pos);
+            if (tok->tok_type==JSWR_TOKEN_STRUCT)
+                error_type=jswrwriter_writestruct(tok, st->level, jswr);
+            else
+                error_type=jswrwriter_writebulk(tok, st->level, jswr);
+            beauty_break=0; //Its break went before its opening, and its closing, like one generated on its own, has none.
+            if (st->level>0 || jswr->setting_allowextradata)
+                st->need_comma=1;
+            else
+                st->is_end=1;
+        break;
+
+        case JSWR_TOKEN_CACHED: //Checked like a bulk array, as a whole value.
+            if (!st->prev_key)
+            {
+                if (!st->checked && jswrwriter_istokenitem(st->prev_type,0) && !in_array)
+                    return JSWR_ERROR_INVALBRACKET;
+                jswrwriter_writetab(beauty_break,st->level,st,jswr);
+            }
+            st->prev_key=0;
+            jswrwriter_writecached(tok, st->level, jswr);
+            beauty_break=(unsigned int) tok->num_int; //Left as the value's last command had it.
+            if (st->level>0 || jswr->setting_allowextradata)
+                st->need_comma=1;
+            else
+                st->is_end=1;
+        break;
+
+        case JSWR_TOKEN_OBJCLOSE:
+        case JSWR_TOKEN_ARRAYCLOSE:
+            if (!st->checked && st->prev_key)
+                return JSWR_ERROR_UNCLOSEDKEY;
+            if (!st->checked && st->level<=0)
+                return JSWR_ERROR_UNEXPECTEDBRACKET;
+            if (!st->checked && jswrwriter_toplevel(st)!=(tok->tok_type==JSWR_TOKEN_OBJCLOSE ? JSWR_LEVEL_OBJ : JSWR_LEVEL_ARRAY))
+                return JSWR_ERROR_MISMATCH;
+            st->level-=1;
+            if (JSWR_DEBUGPRINT) printf("Closing... Back to Level %d (%u)\n",st->level,st->pos);
+            jswrwriter_writetab(beauty_break,st->level,st,jswr);
+            st->compact=0;
+            beauty_break=tok->beauty_break;
+            if (tok->tok_type==JSWR_TOKEN_OBJCLOSE)
+                jswrwriter_putc('}',jswr);
+            else
+                jswrwriter_putc(']',jswr);
+            if (st->level>0 || jswr->setting_allowextradata)
+                st->need_comma=1;
+            else
+                st->is_end=1;
+        break;
+    }
+    if (error_type!=JSWR_SUCCESS)
+        return error_type;
+    st->prev_type=tok->tok_type;
+    st->prev_break=(unsigned char) beauty_break;
+    st->pos+=1;
+    return JSWR_SUCCESS;
+}
+
+static int jswrwriter_iscompact(const unsigned char * tape, unsigned int left, const unsigned int max_items);
+
+/*
+* Writes a fragment's commands in the current state. The first one is checked where it lands,
+* and the rest were checked when the fragment was made, so only its depth is checked against where it goes.
+*/
+static int jswrwriter_emitfragment(const jswrtok_t * tok, jswrstate_t * st, jswrwriter_obj * jswr)
+{
+    jswrtok_t sub;
+    const unsigned char * tape;
+    unsigned int i;
+    int error_type;
+    unsigned char checked;
+    if (tok->str==NULL)
+        return tok->num_int;
+    if (!st->checked && (unsigned int) (st->level+tok->num_int)>jswr->setting_maxdepth)
+        return JSWR_ERROR_TOODEEP;
+    checked=st->checked;
+    error_type=JSWR_SUCCESS;
+    tape=tok->str;
+    for (i=0;i<tok->str_size && error_type==JSWR_SUCCESS;i++)
+    {
+        tape=jswrwriter_tape_read(tape, &sub);
+        if (i==0 && tok->beauty_break) //A break asked for before the fragment goes to its first command.
+            sub.beauty_break=1;
+        error_type=jswrwriter_emit(&sub, st, jswr);
+        st->checked=1;
+        if (sub.tok_type==JSWR_TOKEN_ARRAYOPEN && jswr->setting_compact>0 && jswr->setting_uselines)
+            st->compact=(unsigned char) jswrwriter_iscompact(tape, tok->str_size-i-1, jswr->setting_compact);
+    }
+    st->checked=checked;
+    return error_type;
+}
+
+/*
+* The checks from jswrwriter_emit without the writing, for validating each command as it's generated.
+* Has to be kept in step with emit, which skips its own checks on commands that have passed these.
+*/
+static int jswrwriter_check(const jswrtok_t * tok, jswrstate_t * st, jswrwriter_obj * jswr)
+{
+    int in_array,error_type,close_type;
+    jswrtok_t first;
+    if (st->is_end) //Parsing stops at the end of the root data, so anything after it is left out.
+        return JSWR_SUCCESS;
+    if (tok->tok_type==JSWR_TOKEN_FRAGMENT) //Already checked inside, so it only has to fit where its first command lands.
+    {
+        if (tok->str==NULL)
+            return tok->num_int;
+        if ((unsigned int) (st->level+tok->num_int)>jswr->setting_maxdepth)
+            return JSWR_ERROR_TOODEEP;
+        jswrwriter_tape_read(tok->str, &first);
+        if (first.tok_type!=JSWR_TOKEN_OBJOPEN && first.tok_type!=JSWR_TOKEN_ARRAYOPEN)
+            return jswrwriter_check(&first, st, jswr);
+        close_type=(first.tok_type==JSWR_TOKEN_OBJOPEN) ? JSWR_TOKEN_OBJCLOSE : JSWR_TOKEN_ARRAYCLOSE;
+        first.tok_type=JSWR_TOKEN_INTARRAY; //Checked like a bulk array, an opening and closing in one.
+        error_type=jswrwriter_check(&first, st, jswr);
+        if (error_type==JSWR_SUCCESS)
+            st->prev_type=close_type;
+        return error_type;
+    }
+    in_array=0;
+    if (st->level>0 && jswrwriter_toplevel(st)==JSWR_LEVEL_ARRAY)
+        in_array=1;
+    switch (tok->tok_type)
+    {
+        default:
+            if (st->level==0 && !jswr->setting_allowrootdata)
+                return JSWR_ERROR_TOKENOUTSIDE;
+            if (!in_array)
+            {
+                if (!st->prev_key)
+                    return JSWR_ERROR_NOKEY;
+                st->prev_key=0;
+            }
+        break;
+
+        case JSWR_TOKEN_STRING:
+        case JSWR_TOKEN_KEY:
+        case JSWR_TOKEN_KEYREF:
+            if (st->level==0 && !jswr->setting_allowrootdata)
+                return JSWR_ERROR_TOKENOUTSIDE;
+            if (!in_array)
+                st->prev_key=!st->prev_key;
+        break;
+
+        case JSWR_TOKEN_OBJOPEN:
+        case JSWR_TOKEN_ARRAYOPEN:
+        case JSWR_TOKEN_INTARRAY:
+        case JSWR_TOKEN_DOUBLEARRAY:
+        case JSWR_TOKEN_BOOLARRAY:
+        case JSWR_TOKEN_STRINGARRAY:
+        case JSWR_TOKEN_CACHED:
+        case JSWR_TOKEN_STRUCT:
+            if ((tok->tok_type==JSWR_TOKEN_OBJOPEN || tok->tok_type==JSWR_TOKEN_ARRAYOPEN) && (unsigned int) st->level>=jswr->setting_maxdepth)
+                return JSWR_ERROR_TOODEEP;
+            if (!st->prev_key && jswrwriter_istokenitem(st->prev_type,0) && !in_array)
+                return JSWR_ERROR_INVALBRACKET;
+            st->prev_key=0;
+            if (tok->tok_type==JSWR_TOKEN_OBJOPEN)
+                jswrwriter_pushlevel(JSWR_LEVEL_OBJ, st);
+            else if (tok->tok_type==JSWR_TOKEN_ARRAYOPEN)
+                jswrwriter_pushlevel(JSWR_LEVEL_ARRAY, st);
+            else if (st->level==0 && !jswr->setting_allowextradata)
+                st->is_end=1;
+        break;
+
+        case JSWR_TOKEN_OBJCLOSE:
+        case JSWR_TOKEN_ARRAYCLOSE:
+            if (st->prev_key)
+                return JSWR_ERROR_UNCLOSEDKEY;
+            if (st->level<=0)
+                return JSWR_ERROR_UNEXPECTEDBRACKET;
+            if (jswrwriter_toplevel(st)!=(tok->tok_type==JSWR_TOKEN_OBJCLOSE ? JSWR_LEVEL_OBJ : JSWR_LEVEL_ARRAY))
+                return JSWR_ERROR_MISMATCH;
+            st->level-=1;
+            if (st->level==0 && !jswr->setting_allowextradata)
+                st->is_end=1;
+        break;
+    }
+    st->prev_type=tok->tok_type;
+    return JSWR_SUCCESS;
+}
+
+static void jswrwriter_flush(jswrwriter_obj * jswr)
+{
+    if (jswr->wr_sink==NULL || jswr->wr_strsize==0)
+        return;
+    if (jswr->wr_sink(jswr->wr_sinkdata, jswr->wr_str, jswr->wr_strsize)!=jswr->wr_strsize && jswr->wr_error==JSWR_SUCCESS)
+        jswr->wr_error=JSWR_ERROR_WRITEFAIL;
+    jswrwriter_markstr(jswr);
+    jswr->wr_strsize=0;
+    jswr->wr_str[0]='\0';
+}
+
+static void jswrwriter_gen_end(jswrwriter_obj * jswr)
+{
+    if (!jswr->wr_streaming)
+    {
+        if (jswr->setting_validate)
+        {
+            if (jswr->wr_checkerror!=JSWR_SUCCESS) //Nothing after the first error is kept, since it can't be written anyway.
+                return;
+            jswr->wr_checkerror=jswrwriter_check(&jswr->wr_gentok, &jswr->wr_checkstate, jswr);
+            if (jswr->wr_checkerror!=JSWR_SUCCESS)
+            {
+                jswr->wr_checkpos=jswr->wr_size;
+                return;
+            }
+        }
+        jswrwriter_tape_push(&jswr->wr_gentok, jswr);
+        return;
+    }
+    if (jswr->wr_error!=JSWR_SUCCESS)
+        return;
+    jswr->wr_error=jswrwriter_emit(&jswr->wr_gentok, &jswr->wr_state, jswr);
+    if (jswr->wr_strsize>=jswr->setting_chunksize)
+        jswrwriter_flush(jswr);
+}
+
+/*
+* Checks that count commands make up a single value, once, so they can be written later without checking each one again.
+* They're checked as the item of an array, so none of the root settings come into it. Gives back how deep the value goes.
+*/
+static int jswrwriter_checkfragment(const unsigned char * tape, const unsigned int count, int * depth, jswrwriter_obj * jswr)
+{
+    jswrstate_t st;
+    jswrtok_t tok;
+    unsigned int i;
+    int error_type;
+    jswrwriter_initstate(&st);
+    st.level_bits[0]=0; //Pushing only sets its own bit.
+    jswrwriter_pushlevel(JSWR_LEVEL_ARRAY, &st);
+    *depth=0;
+    for (i=0;i<count;i++)
+    {
+        tape=jswrwriter_tape_read(tape, &tok);
+        if (st.level==1 && i>0)
+            return JSWR_ERROR_UNEXPECTEDEXTRA;
+        if (!jswrwriter_istokenitem(tok.tok_type,1) && st.level==1)
+            return JSWR_ERROR_UNEXPECTEDBRACKET;
+        error_type=jswrwriter_check(&tok, &st, jswr);
+        if (error_type!=JSWR_SUCCESS)
+            return error_type;
+        if (tok.tok_type==JSWR_TOKEN_FRAGMENT && st.level-1+tok.num_int>*depth)
+            *depth=st.level-1+tok.num_int;
+        if (st.level-1>*depth)
+            *depth=st.level-1;
+    }
+    if (st.level>1)
+        return JSWR_ERROR_EXPECTEDBRACKET;
+    return JSWR_SUCCESS;
+}
+
+/*
+* Moves the child's tape, its used arena blocks, and the tapes it took from its own fragments, over to the writer.
+* The blocks go in just before the current one, so they're kept as they are until the commands are cleared.
+*/
+static void jswrwriter_takefragment(jswrwriter_obj * child, jswrwriter_obj * jswr)
+{
+    jswrblock_t ** link;
+    jswrblock_t * first;
+    jswrblock_t * last;
+    unsigned int i;
+    if (jswr->wr_fragcount+child->wr_fragcount+1>jswr->wr_fragcap)
+    {
+        jswr->wr_fragcap=jswr->wr_fragcap ? jswr->wr_fragcap*2 : 8;
+        while (jswr->wr_fragcap<jswr->wr_fragcount+child->wr_fragcount+1)
+            jswr->wr_fragcap*=2;
+        jswr->wr_frags=(unsigned char **) realloc(jswr->wr_frags, sizeof(unsigned char *) * jswr->wr_fragcap);
+    }
+    jswr->wr_frags[jswr->wr_fragcount++]=child->wr_tape;
+    for (i=0;i<child->wr_fragcount;i++)
+        jswr->wr_frags[jswr->wr_fragcount++]=child->wr_frags[i];
+    child->wr_fragcount=0;
+    child->wr_tape=NULL;
+    child->wr_tapecap=0;
+    if (child->wr_arenacur!=NULL)
+    {
+        first=child->wr_arena;
+        last=child->wr_arenacur;
+        child->wr_arena=last->next; //The unused blocks past the current one stay with the child.
+        last->next=NULL;
+        if (jswr->wr_arenacur==NULL)
+        {
+            jswr->wr_arena=first;
+            jswr->wr_arenacur=last;
+        }
+        else
+        {
+            link=&jswr->wr_arena;
+            while (*link!=jswr->wr_arenacur)
+                link=&(*link)->next;
+            last->next=jswr->wr_arenacur;
+            *link=first;
+        }
+    }
+    jswrwriter_clear_tokens(child);
+}
+
+JSWR_API void jswrwriter_gen_fragment(jswrwriter_obj * child, jswrwriter_obj * jswr)
+{
+    jswrtok_t * tok;
+    int error_type,depth;
+    if (child->wr_size==0)
+        return;
+    if (child->setting_validate && child->wr_checkerror!=JSWR_SUCCESS)
+        error_type=child->wr_checkerror;
+    else
+        error_type=jswrwriter_checkfragment(child->wr_tape, child->wr_size, &depth, child);
+    tok=jswrwriter_gen_x(JSWR_TOKEN_FRAGMENT, jswr);
+    if (error_type!=JSWR_SUCCESS) //Kept as just its error, which is given back when it's reached.
+    {
+        tok->num_int=error_type;
+        jswrwriter_gen_end(jswr);
+        return;
+    }
+    tok->num_int=depth;
+    tok->str_size=child->wr_size;
+    tok->str=child->wr_tape;
+    if (!jswr->wr_streaming) //Streamed fragments are written before the call returns, so the child can keep its commands.
+        jswrwriter_takefragment(child, jswr);
+    jswrwriter_gen_end(jswr);
+    return;
+}
+
+#ifdef JSWR_THREADS
+#ifdef _WIN32
+#define JSWR_CACHE_LOCK(cache) EnterCriticalSection(&(cache)->lock)
+#define JSWR_CACHE_UNLOCK(cache) LeaveCriticalSection(&(cache)->lock)
+#else
+#define JSWR_CACHE_LOCK(cache) pthread_mutex_lock(&(cache)->lock)
+#define JSWR_CACHE_UNLOCK(cache) pthread_mutex_unlock(&(cache)->lock)
+#endif
+#else
+#define JSWR_CACHE_LOCK(cache)
+#define JSWR_CACHE_UNLOCK(cache)
+#endif
+
+JSWR_API void jswrwriter_cache_init(jswrcache_t * cache, const unsigned int max_size)
+{
+    cache->buckets=NULL;
+    cache->bucket_count=0;
+    cache->entry_count=0;
+    cache->newest=NULL;
+    cache->oldest=NULL;
+    cache->size=0;
+    cache->max_size=max_size;
+    cache->hits=0;
+    cache->misses=0;
+#ifdef JSWR_THREADS
+#ifdef _WIN32
+    InitializeCriticalSection(&cache->lock);
+#else
+    pthread_mutex_init(&cache->lock, NULL);
+#endif
+#endif
+}
+
+static void jswrwriter_cache_freeentry(jswrcacheentry_t * entry)
+{
+    free(entry->str[0]);
+    free(entry->str[1]);
+    free(entry->key);
+    free(entry);
+}
+
+JSWR_API void jswrwriter_cache_free(jswrcache_t * cache)
+{
+    jswrcacheentry_t * entry;
+    while (cache->newest!=NULL)
+    {
+        entry=cache->newest->older;
+        jswrwriter_cache_freeentry(cache->newest);
+        cache->newest=entry;
+    }
+    free(cache->buckets);
+    cache->buckets=NULL;
+#ifdef JSWR_THREADS
+#ifdef _WIN32
+    DeleteCriticalSection(&cache->lock);
+#else
+    pthread_mutex_destroy(&cache->lock);
+#endif
+#endif
+}
+
+JSWR_API void jswrwriter_set_cache(jswrcache_t * cache, jswrwriter_obj * jswr)
+{
+    jswr->wr_cache=cache;
+    jswr->wr_cachedepth=0;
+}
+
+static unsigned long jswrwriter_cache_hash(const unsigned char * key, const unsigned int key_size) //FNV-1a.
+{
+    unsigned long hash;
+    unsigned int i;
+    hash=2166136261UL;
+    for (i=0;i<key_size;i++)
+    {
+        hash^=key[i];
+        hash=(hash*16777619UL) & 0xFFFFFFFFUL;
+    }
+    return hash;
+}
+
+static jswrcacheentry_t * jswrwriter_cache_find(jswrcache_t * cache, const unsigned char * key, const unsigned int key_size, const unsigned long hash)
+{
+    jswrcacheentry_t * entry;
+    if (cache->bucket_count==0)
+        return NULL;
+    for (entry=cache->buckets[hash & (cache->bucket_count-1)];entry!=NULL;entry=entry->next)
+    {
+        if (entry->hash==hash && entry->key_size==key_size && memcmp(entry->key, key, key_size)==0)
+            return entry;
+    }
+    return NULL;
+}
+
+static void jswrwriter_cache_unlink(jswrcache_t * cache, jswrcacheentry_t * entry) //Takes it out of the use order.
+{
+    if (entry->newer!=NULL)
+        entry->newer->older=entry->older;
+    else
+        cache->newest=entry->older;
+    if (entry->older!=NULL)
+        entry->older->newer=entry->newer;
+    else
+        cache->oldest=entry->newer;
+}
+
+static void jswrwriter_cache_touch(jswrcache_t * cache, jswrcacheentry_t * entry) //Makes it the most recently used.
+{
+    entry->newer=NULL;
+    entry->older=cache->newest;
+    if (cache->newest!=NULL)
+        cache->newest->newer=entry;
+    cache->newest=entry;
+    if (cache->oldest==NULL)
+        cache->oldest=entry;
+}
+
+static unsigned int jswrwriter_cache_entrysize(const jswrcacheentry_t * entry)
+{
+    return (unsigned int) sizeof(jswrcacheentry_t)+entry->key_size+entry->str_size[0]+entry->str_size[1];
+}
+
+static void jswrwriter_cache_remove(jswrcache_t * cache, jswrcacheentry_t * entry)
+{
+    jswrcacheentry_t ** link;
+    link=&cache->buckets[entry->hash & (cache->bucket_count-1)];
+    while (*link!=entry)
+        link=&(*link)->next;
+    *link=entry->next;
+    jswrwriter_cache_unlink(cache, entry);
+    cache->size-=jswrwriter_cache_entrysize(entry);
+    cache->entry_count--;
+    jswrwriter_cache_freeentry(entry);
+}
+
+static void jswrwriter_cache_grow(jswrcache_t * cache) //Doubles the buckets once there's an entry for each.
+{
+    jswrcacheentry_t ** buckets;
+    jswrcacheentry_t * entry;
+    unsigned int i,bucket_count;
+    bucket_count=cache->bucket_count ? cache->bucket_count*2 : 64;
+    buckets=(jswrcacheentry_t **) malloc(sizeof(jswrcacheentry_t *) * bucket_count);
+    for (i=0;i<bucket_count;i++)
+        buckets[i]=NULL;
+    for (entry=cache->newest;entry!=NULL;entry=entry->older)
+    {
+        entry->next=buckets[entry->hash & (bucket_count-1)];
+        buckets[entry->hash & (bucket_count-1)]=entry;
+    }
+    free(cache->buckets);
+    cache->buckets=buckets;
+    cache->bucket_count=bucket_count;
+}
+
+static void jswrwriter_cache_style(jswrcachestyle_t * style, const jswrwriter_obj * jswr) //The settings that change how a value is written.
+{
+    style->indentwidth=jswr->setting_indentwidth;
+    style->indentspaces=jswr->setting_indentspaces;
+    style->compact=jswr->setting_compact;
+    style->escape=jswr->setting_escape;
+    style->utf8=jswr->setting_utf8;
+    style->nonfinite=jswr->setting_nonfinite;
+    style->rawcheck=jswr->setting_rawcheck;
+}
+
+static int jswrwriter_cache_samestyle(const jswrcachestyle_t * style, const jswrwriter_obj * jswr)
+{
+    jswrcachestyle_t current;
+    jswrwriter_cache_style(&current, jswr);
+    return style->indentwidth==current.indentwidth && style->indentspaces==current.indentspaces && style->compact==current.compact
+        && style->escape==current.escape && style->utf8==current.utf8 && style->nonfinite==current.nonfinite && style->rawcheck==current.rawcheck;
+}
+
+JSWR_API int jswrwriter_cache_begin(const char * key, const unsigned int key_size, jswrwriter_obj * jswr)
+{
+    jswrcache_t * cache;
+    jswrcacheentry_t * entry;
+    jswrcacheopen_t * open;
+    jswrtok_t * tok;
+    unsigned char * str_copy;
+    unsigned int style;
+    unsigned long hash;
+    cache=jswr->wr_cache;
+    if (cache==NULL || jswr->wr_streaming) //Values are written from their commands, which aren't kept when streaming.
+        return 0;
+    style=jswr->setting_uselines ? 1 : 0;
+    hash=jswrwriter_cache_hash((const unsigned char *) key, key_size);
+    JSWR_CACHE_LOCK(cache);
+    entry=jswrwriter_cache_find(cache, (const unsigned char *) key, key_size, hash);
+    if (entry!=NULL && entry->str[style]!=NULL && jswrwriter_cache_samestyle(&entry->style[style], jswr))
+    {
+        cache->hits++;
+        jswrwriter_cache_unlink(cache, entry);
+        jswrwriter_cache_touch(cache, entry);
+        tok=jswrwriter_gen_x(JSWR_TOKEN_CACHED, jswr);
+        str_copy=jswrwriter_arena_alloc(entry->str_size[style], 1, jswr); //Copied while locked, since it can be thrown out as soon as it's unlocked.
+        memcpy(str_copy, entry->str[style], entry->str_size[style]);
+        tok->str=str_copy;
+        tok->str_size=entry->str_size[style];
+        tok->num_int=entry->last_break[style];
+        if (entry->first_break[style])
+            tok->beauty_break=1;
+        JSWR_CACHE_UNLOCK(cache);
+        jswrwriter_gen_end(jswr);
+        return 1;
+    }
+    cache->misses++;
+    JSWR_CACHE_UNLOCK(cache);
+    if (jswr->wr_cachedepth<JSWR_CACHE_DEPTH) //Deeper ones are still generated, just not cached.
+    {
+        open=&jswr->wr_cacheopen[jswr->wr_cachedepth];
+        str_copy=jswrwriter_arena_alloc(key_size, 1, jswr);
+        memcpy(str_copy, key, key_size);
+        open->key=str_copy;
+        open->key_size=key_size;
+        open->tape_start=jswr->wr_tapesize;
+        open->size_start=jswr->wr_size;
+        open->site_break=(unsigned char) (jswr->wr_addbreak!=0);
+        open->value_break=0;
+    }
+    jswr->wr_cachedepth++;
+    return 0;
+}
+
+/*
+* Writes count commands as a single value at level 0, on a copy of the writer with its own string data, for the cache.
+* They've been checked already, so it starts as if just past a key, which lets any value be written at the root.
+*/
+static char * jswrwriter_cache_write(const unsigned char * tape, const unsigned int count, unsigned int * str_size, unsigned char * first_break, unsigned char * last_break, const jswrwriter_obj * jswr)
+{
+    jswrwriter_obj shadow;
+    jswrstate_t st;
+    jswrtok_t tok;
+    unsigned int i;
+    int error_type;
+    shadow=*jswr;
+    shadow.wr_str=(char *) malloc(sizeof(char) * JSWR_STR_MINSIZE);
+    shadow.wr_str[0]='\0';
+    shadow.wr_strsize=0;
+    shadow.wr_strcap=JSWR_STR_MINSIZE;
+    shadow.wr_indent=NULL;
+    shadow.wr_indentsize=0;
+    shadow.wr_sink=NULL;
+    jswrwriter_initstate(&st);
+    st.prev_key=1;
+    st.checked=1;
+    error_type=JSWR_SUCCESS;
+    for (i=0;i<count && error_type==JSWR_SUCCESS;i++)
+    {
+        tape=jswrwriter_tape_read(tape, &tok);
+        if (i==0)
+            *first_break=(unsigned char) tok.beauty_break;
+        error_type=jswrwriter_emit(&tok, &st, &shadow);
+        if (tok.tok_type==JSWR_TOKEN_ARRAYOPEN && shadow.setting_compact>0 && shadow.setting_uselines)
+            st.compact=(unsigned char) jswrwriter_iscompact(tape, count-i-1, shadow.setting_compact);
+    }
+    free(shadow.wr_indent);
+    if (error_type!=JSWR_SUCCESS) //Such as a non-finite number set to be an error, which is left for the parse to give.
+    {
+        free(shadow.wr_str);
+        return NULL;
+    }
+    *str_size=shadow.wr_strsize;
+    *last_break=st.prev_break;
+    return shadow.wr_str;
+}
+
+JSWR_API void jswrwriter_cache_end(jswrwriter_obj * jswr)
+{
+    jswrcache_t * cache;
+    jswrcacheentry_t * entry;
+    jswrcacheopen_t * open;
+    char * str;
+    unsigned int style,str_size,count;
+    unsigned long hash;
+    unsigned char first_break,last_break;
+    int depth;
+    cache=jswr->wr_cache;
+    if (cache==NULL || jswr->wr_streaming || jswr->wr_cachedepth==0)
+        return;
+    jswr->wr_cachedepth--;
+    if (jswr->wr_cachedepth>=JSWR_CACHE_DEPTH)
+        return;
+    open=&jswr->wr_cacheopen[jswr->wr_cachedepth];
+    count=jswr->wr_size-open->size_start;
+    if (count==0 || (jswr->setting_validate && jswr->wr_checkerror!=JSWR_SUCCESS))
+        return;
+    if (jswrwriter_checkfragment(jswr->wr_tape+open->tape_start, count, &depth, jswr)!=JSWR_SUCCESS) //Anything that isn't a single value is left to be reported by the parse.
+        return;
+    str=jswrwriter_cache_write(jswr->wr_tape+open->tape_start, count, &str_size, &first_break, &last_break, jswr);
+    if (str==NULL)
+        return;
+    if (open->site_break && !open->value_break) //Hits get whatever break is pending where they're used, from generating.
+        first_break=0;
+    style=jswr->setting_uselines ? 1 : 0;
+    hash=jswrwriter_cache_hash(open->key, open->key_size);
+    JSWR_CACHE_LOCK(cache);
+    entry=jswrwriter_cache_find(cache, open->key, open->key_size, hash);
+    if (entry==NULL)
+    {
+        if (cache->entry_count>=cache->bucket_count)
+            jswrwriter_cache_grow(cache);
+        entry=(jswrcacheentry_t *) malloc(sizeof(jswrcacheentry_t));
+        entry->hash=hash;
+        entry->key=(unsigned char *) malloc(open->key_size+1);
+        memcpy(entry->key, open->key, open->key_size);
+        entry->key_size=open->key_size;
+        entry->str[0]=NULL;
+        entry->str[1]=NULL;
+        entry->str_size[0]=0;
+        entry->str_size[1]=0;
+        entry->next=cache->buckets[hash & (cache->bucket_count-1)];
+        cache->buckets[hash & (cache->bucket_count-1)]=entry;
+        cache->entry_count++;
+        cache->size+=jswrwriter_cache_entrysize(entry);
+    }
+    else
+        jswrwriter_cache_unlink(cache, entry);
+    jswrwriter_cache_touch(cache, entry);
+    cache->size-=entry->str_size[style];
+    free(entry->str[style]);
+    entry->str[style]=str; //Taken over as it is, rather than copied.
+    entry->str_size[style]=str_size;
+    entry->first_break[style]=first_break;
+    entry->last_break[style]=last_break;
+    jswrwriter_cache_style(&entry->style[style], jswr);
+    cache->size+=str_size;
+    while (cache->oldest!=NULL && cache->size>cache->max_size) //Least recently used first, which can be this one if it's too big to keep.
+        jswrwriter_cache_remove(cache, cache->oldest);
+    JSWR_CACHE_UNLOCK(cache);
+}
+
+static unsigned int jswrwriter_sink_file(void * userdata, const char * data, unsigned int size)
+{
+    return (unsigned int) fwrite(data, sizeof(char), size, (FILE *) userdata);
+}
+
+JSWR_API void jswrwriter_set_sink_callback(jswrsink_fn sink, void * userdata, jswrwriter_obj * jswr)
+{
+    jswr->wr_sink=sink;
+    jswr->wr_sinkdata=userdata;
+}
+
+JSWR_API void jswrwriter_set_sink_file(FILE * file, jswrwriter_obj * jswr)
+{
+    jswrwriter_set_sink_callback(jswrwriter_sink_file, file, jswr);
+}
+
+#ifndef JSWR_NO_FD
+static unsigned int jswrwriter_sink_fd(void * userdata, const char * data, unsigned int size)
+{
+    jswrwriter_obj * jswr;
+    unsigned int written;
+    jswr=(jswrwriter_obj *) userdata;
+    written=0;
+    while (written<size)
+    {
+#ifdef _WIN32
+        int result;
+        result=_write(jswr->wr_sinkfd, data+written, size-written);
+#else
+        ssize_t result;
+        result=write(jswr->wr_sinkfd, data+written, size-written);
+        if (result<0 && errno==EINTR)
+            continue;
+#endif
+        if (result<=0)
+            break;
+        written+=(unsigned int) result;
+    }
+    return written;
+}
 
-            case JSWR_TOKEN_UINT:
-                sprintf(num_str, "%u", jswr->wr_token[i].num_int);
-                jswrwriter_puts(num_str,jswr);
-                break;
+JSWR_API void jswrwriter_set_sink_fd(const int fd, jswrwriter_obj * jswr)
+{
+    jswr->wr_sinkfd=fd;
+    jswrwriter_set_sink_callback(jswrwriter_sink_fd, jswr, jswr);
+}
+#endif
 
-            case JSWR_TOKEN_FLOAT:
-                sprintf(num_str, "%g", jswr->wr_token[i].num_float);
-                jswrwriter_puts(num_str,jswr);
-                break;
+static unsigned int jswrwriter_sink_buffer(void * userdata, const char * data, unsigned int size)
+{
+    jswrwriter_obj * jswr;
+    jswr=(jswrwriter_obj *) userdata;
+    if (size>jswr->wr_sinkbufcap-jswr->wr_sinkbufsize)
+        size=jswr->wr_sinkbufcap-jswr->wr_sinkbufsize;
+    memcpy(jswr->wr_sinkbuf+jswr->wr_sinkbufsize, data, size);
+    jswr->wr_sinkbufsize+=size;
+    if (jswr->wr_sinkbufsize<jswr->wr_sinkbufcap)
+        jswr->wr_sinkbuf[jswr->wr_sinkbufsize]='\0';
+    return size;
+}
 
-            case JSWR_TOKEN_UFLOAT:
-                sprintf(num_str, "%g", jswr->wr_token[i].num_float);
-                jswrwriter_puts(num_str,jswr);
-                break;
+JSWR_API void jswrwriter_set_sink_buffer(char * buf, const unsigned int buf_size, jswrwriter_obj * jswr)
+{
+    jswr->wr_sinkbuf=buf;
+    jswr->wr_sinkbufcap=buf_size;
+    jswr->wr_sinkbufsize=0;
+    if (buf_size>0)
+        buf[0]='\0';
+    jswrwriter_set_sink_callback(jswrwriter_sink_buffer, jswr, jswr);
+}
 
-            case JSWR_TOKEN_RAW:
-                a=0;
-                a_exit=0;
-                while (a<jswr->wr_token[i].str_size && !a_exit)
-                {
-                    switch(jswr->wr_token[i].str[a])
-                    {
-                        case '\\':
-                        jswrwriter_puts("\\\\",jswr);
-                        break;
-                        case '"':
-                        jswrwriter_puts("\\\"",jswr);
-                        break;
-                        case '\0':
-                            a_exit=1;
-                        break;
-                        default:
-                        jswrwriter_putc(jswr->wr_token[i].str[a],jswr);
-                        break;
-                    }
-                    a++;
-                }
-                break;
+JSWR_API void jswrwriter_set_sink_none(jswrwriter_obj * jswr)
+{
+    jswrwriter_set_sink_callback(NULL, NULL, jswr);
+}
 
-            default:
-                jswrwriter_puts("\"???\"",jswr);
-                break;
-            }
-        }
+JSWR_API void jswrwriter_set_chunksize(const unsigned int chunk_size, jswrwriter_obj * jswr)
+{
+    jswr->setting_chunksize=chunk_size;
+}
+
+#ifdef JSWR_THREADS
+JSWR_API void jswrwriter_set_threads(const unsigned int thread_count, jswrwriter_obj * jswr)
+{
+    jswr->setting_threads=thread_count;
+    if (jswr->setting_threads<1)
+        jswr->setting_threads=1;
+}
+#endif
+
+JSWR_API void jswrwriter_set_validate(const unsigned char validate, jswrwriter_obj * jswr)
+{
+    unsigned int i;
+    const unsigned char * tape;
+    jswrtok_t tok;
+    jswr->setting_validate=validate;
+    jswrwriter_initstate(&jswr->wr_checkstate);
+    jswr->wr_checkerror=JSWR_SUCCESS;
+    jswr->wr_checkpos=0;
+    if (!validate)
+        return;
+    tape=jswr->wr_tape;
+    for (i=0;i<jswr->wr_size && jswr->wr_checkerror==JSWR_SUCCESS;i++)
+    {
+        tape=jswrwriter_tape_read(tape, &tok);
+        jswr->wr_checkerror=jswrwriter_check(&tok, &jswr->wr_checkstate, jswr);
+        if (jswr->wr_checkerror!=JSWR_SUCCESS)
+            jswr->wr_checkpos=i;
     }
-    return;
 }
 
-JSWR_API int jswrwriter_parse(jswrwriter_obj * jswr)
+JSWR_API int jswrwriter_get_error(unsigned int * token_index, jswrwriter_obj * jswr)
 {
-    unsigned int i,is_error,is_array,prev_key,is_end,temp_beauty;
-    int level,error_type,prev_type;
-    unsigned int * level_types;
-    level_types = (unsigned int *) malloc(0 * sizeof(unsigned int));
-    i=0;
-    level=0;
-    is_error=0;
-    is_array=0;
-    prev_key=0;
-    error_type=JSWR_SUCCESS;
-    prev_type=JSWR_TOKEN_NONE;
-    is_end=0;
-	temp_beauty=1;
-    while (i<jswr->wr_size && !is_error)
-    {
-		temp_beauty=1;
-		if (i+1<jswr->wr_size)
-		{
-			if (jswr->wr_token[i+1].beauty_break==1)
-				temp_beauty=0;
-		}
-		if (jswr->wr_token[i].beauty_break==1)
-			temp_beauty=0;
-		if (jswr->setting_uselines==0)
-			temp_beauty=0;
-		
-        switch (jswr->wr_token[i].tok_type)
+    if (token_index!=NULL)
+        *token_index=jswr->wr_checkpos;
+    return jswr->wr_checkerror;
+}
+
+JSWR_API void jswrwriter_stream_begin(jswrwriter_obj * jswr)
+{
+    jswrwriter_initstate(&jswr->wr_state);
+    jswrwriter_clearstr(jswr);
+    jswr->wr_addbreak=0;
+    jswr->wr_error=JSWR_SUCCESS;
+    jswr->wr_streaming=1;
+}
+
+JSWR_API int jswrwriter_stream_end(jswrwriter_obj * jswr)
+{
+    if (jswr->wr_error==JSWR_SUCCESS && jswr->wr_state.level>0)
+        jswr->wr_error=JSWR_ERROR_EXPECTEDBRACKET;
+    jswrwriter_flush(jswr);
+    jswr->wr_streaming=0;
+    return jswr->wr_error;
+}
+
+JSWR_API void jswrwriter_read_begin(jswrwriter_obj * jswr)
+{
+    jswrwriter_initstate(&jswr->wr_state);
+    jswr->wr_state.checked=jswr->setting_validate;
+    jswrwriter_clearstr(jswr);
+    jswr->wr_error=JSWR_SUCCESS;
+    if (jswr->setting_validate)
+    {
+        if (jswr->wr_checkerror!=JSWR_SUCCESS)
+            jswr->wr_error=jswr->wr_checkerror;
+        else if (jswr->wr_checkstate.level>0)
+            jswr->wr_error=JSWR_ERROR_EXPECTEDBRACKET;
+    }
+    jswr->wr_readtape=jswr->wr_tape;
+    jswr->wr_readindex=0;
+    jswr->wr_readpos=0;
+}
+
+/*
+* Writes one command at a time into the string data, handing it out until buf is full. What doesn't fit is kept for the next read,
+* so the string data never holds more than one command's JSON, however big the whole thing is.
+*/
+JSWR_API int jswrwriter_read(char * buf, const unsigned int cap, unsigned int * out_size, jswrwriter_obj * jswr)
+{
+    jswrstate_t * st;
+    jswrtok_t tok;
+    unsigned int size,n;
+    st=&jswr->wr_state;
+    size=0;
+    if (jswr->wr_readtape==NULL) //Not started, or already read to the end.
+    {
+        *out_size=0;
+        return jswr->wr_error;
+    }
+    while (size<cap)
+    {
+        if (jswr->wr_readpos<jswr->wr_strsize)
         {
-            default:
-                is_array=0;
-                if (level==0 && !jswr->setting_allowrootdata)
-                {
-                    error_type=JSWR_ERROR_TOKENOUTSIDE;
-                    free(level_types);
-                    return error_type;
-                }
-                if (level>0)
-                {
-                    if (level_types[level-1]==JSWR_LEVEL_ARRAY) //General sort of code to tell it's okay to be in arrays without the key, subjected to move around.
-                    {
-                        is_array=1;
-                        if (JSWR_DEBUGPRINT) printf("Item %d in Array (%d)",i,level-1);
-                        jswrwriter_writetab(i,level,jswr);
-                        jswrwriter_writetoken(i, jswr);
-                        if (jswr->wr_size > i+1)
-                        {
-                            if (jswrwriter_istokenitem(jswr->wr_token[i+1].tok_type,1))
-                            {
-								if (JSWR_DEBUGPRINT) printf(",");
-								jswrwriter_putc(',',jswr);
-								if (temp_beauty==0) jswrwriter_putc(' ',jswr);
-                            }
-                        }
-                        if (JSWR_DEBUGPRINT) printf("\n");
-                    }
-                }
-                if (!is_array)
-                {
-                if (!prev_key)
-                {
-                    if (JSWR_DEBUGPRINT) printf("Item %d Problem...\n",i);
-                    error_type=JSWR_ERROR_NOKEY;
-                    free(level_types);
-                    return error_type;
-                }
-                else
-                {
-                    prev_key=0;
-                    if (JSWR_DEBUGPRINT) printf("%d item",i);
-                    jswrwriter_writetoken(i, jswr);
-                    if (jswr->wr_size > i+1)
-                    {
-                        if (jswrwriter_istokenitem(jswr->wr_token[i+1].tok_type, 1))
-                        {
-                            if (JSWR_DEBUGPRINT) printf(",");
-                            jswrwriter_putc(',',jswr);
-                            if (temp_beauty==0) jswrwriter_putc(' ',jswr);
-                        }
-                    }
-                    if (JSWR_DEBUGPRINT) printf("\n");
-                }
-                }
+            n=jswr->wr_strsize-jswr->wr_readpos;
+            if (n>cap-size)
+                n=cap-size;
+            memcpy(buf+size, jswr->wr_str+jswr->wr_readpos, n);
+            size+=n;
+            jswr->wr_readpos+=n;
+            continue;
+        }
+        jswrwriter_markstr(jswr);
+        jswr->wr_strsize=0;
+        jswr->wr_readpos=0;
+        if (jswr->wr_error!=JSWR_SUCCESS || st->is_end || jswr->wr_readindex>=jswr->wr_size)
+        {
+            if (jswr->wr_error==JSWR_SUCCESS && st->level>0)
+                jswr->wr_error=JSWR_ERROR_EXPECTEDBRACKET;
+            jswr->wr_readtape=NULL;
             break;
+        }
+        jswr->wr_readtape=jswrwriter_tape_read(jswr->wr_readtape, &tok);
+        jswr->wr_error=jswrwriter_emit(&tok, st, jswr);
+        if (tok.tok_type==JSWR_TOKEN_ARRAYOPEN && jswr->setting_compact>0 && jswr->setting_uselines)
+            st->compact=(unsigned char) jswrwriter_iscompact(jswr->wr_readtape, jswr->wr_size-jswr->wr_readindex-1, jswr->setting_compact);
+        jswr->wr_readindex++;
+    }
+    *out_size=size;
+    return jswr->wr_error;
+}
 
-            case JSWR_TOKEN_STRING:
-            if (level==0 && !jswr->setting_allowrootdata)
-            {
-                error_type=JSWR_ERROR_TOKENOUTSIDE;
-                free(level_types);
-                return error_type;
-            }
-            is_array=0;
-            if (level>0)
-            {
-                if (level_types[level-1]==JSWR_LEVEL_ARRAY) //General sort of code to tell it's okay to be in arrays without the key, subjected to move around.
-                {
-                    is_array=1;
-                    if (JSWR_DEBUGPRINT) printf("Item %d in Array (%d)",i,level-1);
-                    jswrwriter_writetab(i,level,jswr);
-                    jswrwriter_writetoken(i, jswr);
-                    if (jswr->wr_size > i+1)
-                    {
-                        if (jswrwriter_istokenitem(jswr->wr_token[i+1].tok_type, 1))
-                        {
-                        if (JSWR_DEBUGPRINT) printf(",");
-                        jswrwriter_putc(',',jswr);
-                        if (temp_beauty==0) jswrwriter_putc(' ',jswr);
-                        }
-                    }
-                    if (JSWR_DEBUGPRINT) printf("\n");
-                }
-            }
-            if (!is_array)
-            {
-            if (!prev_key)
-            {
-                prev_key=1;
-                if (JSWR_DEBUGPRINT) printf("%d key-string\n",i);
-                jswrwriter_writetab(i,level,jswr);
-                jswrwriter_writetoken(i, jswr);
-                jswrwriter_puts(": ", jswr);
-            }
-            else
-            {
-                if (JSWR_DEBUGPRINT) printf("%d string",i);
-                jswrwriter_writetoken(i, jswr);
-                prev_key=0;
-                if (jswr->wr_size > i+1)
-                {
-                    if (jswrwriter_istokenitem(jswr->wr_token[i+1].tok_type,1))
-                    {
-                    if (JSWR_DEBUGPRINT) printf(",");
-                    jswrwriter_putc(',',jswr);
-                    if (temp_beauty==0) jswrwriter_putc(' ',jswr);
-                    }
-                }
-                if (JSWR_DEBUGPRINT) printf("\n");
-            }
-            }
-            break;
+/*
+* Looks ahead from just past an array opening, for whether the array is only plain values, and no more than max_items of them.
+*/
+static int jswrwriter_iscompact(const unsigned char * tape, unsigned int left, const unsigned int max_items)
+{
+    unsigned int items;
+    jswrtok_t tok;
+    items=0;
+    while (left>0)
+    {
+        tape=jswrwriter_tape_read(tape, &tok);
+        left--;
+        if (tok.tok_type==JSWR_TOKEN_ARRAYCLOSE)
+            return 1;
+        while (tok.tok_type==JSWR_TOKEN_FRAGMENT && tok.str!=NULL && tok.str_size==1) //A lone value, looked at as itself.
+            jswrwriter_tape_read(tok.str, &tok);
+        if (tok.tok_type==JSWR_TOKEN_CACHED && tok.str_size>0 && tok.str[0]!='{' && tok.str[0]!='[') //Cached plain values are still plain.
+            tok.tok_type=JSWR_TOKEN_RAW;
+        if (tok.tok_type==JSWR_TOKEN_OBJOPEN || tok.tok_type==JSWR_TOKEN_ARRAYOPEN || (tok.tok_type>=JSWR_TOKEN_INTARRAY && tok.tok_type<=JSWR_TOKEN_CACHED) || tok.tok_type==JSWR_TOKEN_STRUCT)
+            return 0;
+        items++;
+        if (items>max_items)
+            return 0;
+    }
+    return 0;
+}
 
-            case JSWR_TOKEN_OBJOPEN:
-            is_array=0;
-            if (is_end && !jswr->setting_allowextradata)
-            {
-                error_type=JSWR_ERROR_UNEXPECTEDEXTRA;
-                free(level_types);
-                return error_type;
-            }
-            if (!prev_key)
-            {
-                if (level>0)
-                {
-                    if (level_types[level-1]==JSWR_LEVEL_ARRAY)
-                    {
-                        is_array=1;
-                        if (JSWR_DEBUGPRINT) printf("%d Object Opening in Array (%d)\n",i,level-1);
-                    }
-                }
-                if (jswrwriter_istokenitem(prev_type,0) && !is_array)
-                {
-                    error_type=JSWR_ERROR_INVALBRACKET;
-                    free(level_types);
-                    return error_type;
-                }
-                jswrwriter_writetab(i,level,jswr);
-            }
-            prev_key=0;
-            level+=1;
-            level_types = realloc(level_types, level * sizeof(unsigned int));
-            level_types[level-1]=JSWR_LEVEL_OBJ;
-            if (JSWR_DEBUGPRINT) printf("Object Opening (%d)\n",i);
-            jswrwriter_putc('{',jswr);
-            break;
+#ifdef JSWR_THREADS
+typedef struct jswrchunk
+{
+    const unsigned char * tape;
+    unsigned int count;
+    unsigned char need_comma;
+    unsigned char prev_break;
+    char * str;
+    unsigned int str_size;
+    int error;
+} jswrchunk_t;
 
-            case JSWR_TOKEN_OBJCLOSE:
-            if (prev_key)
-            {
-                error_type=JSWR_ERROR_UNCLOSEDKEY;
-                free(level_types);
-                return error_type;
-            }
-            if (level_types[level-1]==JSWR_LEVEL_OBJ)
-            {
-            level-=1;
-            if (level<0)
-            {
-                level=0;
-                is_error=1;
-                error_type=JSWR_ERROR_UNEXPECTEDBRACKET;
-                free(level_types);
-                return error_type;
-            }
-            level_types = realloc(level_types, level * sizeof(unsigned int));
-            jswrwriter_writetab(i,level,jswr);
-            jswrwriter_putc('}',jswr);
-            if (level>0)
-            {
-                if (JSWR_DEBUGPRINT) printf("Object Closing... ");
-                switch(level_types[level-1])
-                {
-                case JSWR_LEVEL_ARRAY:
-                    if (JSWR_DEBUGPRINT) printf("Back to Array? (%d)",i,level-1);
-                    if (jswr->wr_size > i+1)
-                    {
-                        if (jswrwriter_istokenitem(jswr->wr_token[i+1].tok_type, 1))
-                        {
-                            if (JSWR_DEBUGPRINT) printf(",");
-                            jswrwriter_putc(',',jswr);
-                            if (temp_beauty==0) jswrwriter_putc(' ',jswr);
-                        }
-                    }
-                    if (JSWR_DEBUGPRINT) printf("\n");
-                break;
-                case JSWR_LEVEL_OBJ:
-                    if (JSWR_DEBUGPRINT) printf("Back to Object? (%d)",i,level-1);
-                    if (jswr->wr_size > i+1)
-                    {
-                        if (jswrwriter_istokenitem(jswr->wr_token[i+1].tok_type, 1))
-                        {
-                            if (JSWR_DEBUGPRINT) printf(",");
-                            jswrwriter_putc(',',jswr);
-                            if (temp_beauty==0) jswrwriter_putc(' ',jswr);
-                        }
-                    }
-                    if (JSWR_DEBUGPRINT) printf("\n");
-                    break;
-                default:
-                    if (JSWR_DEBUGPRINT) printf("\n");
-                    break;
-                }
-            }
-            if (level==0)
-            {
-                if (JSWR_DEBUGPRINT) printf("Object Closing... Back to Root Level (%d)",i);
-                if (jswr->setting_allowextradata)
-                {
-                if (jswr->wr_size > i+1)
-                {
-                    if (jswrwriter_istokenitem(jswr->wr_token[i+1].tok_type,1))
-                    {
-                        if (JSWR_DEBUGPRINT) printf(",");
-                        jswrwriter_putc(',',jswr);
-                        if (temp_beauty==0) jswrwriter_putc(' ',jswr);
-                    }
-                }
-                }
-                else
-                    is_end=1;
-                if (JSWR_DEBUGPRINT) printf("\n");
-            }
-            }
-            else
-            {
-                is_error=1;
-                error_type=JSWR_ERROR_MISMATCH;
-                if (level<=0)
-                    error_type=JSWR_ERROR_UNEXPECTEDBRACKET;
-                free(level_types);
-                return error_type;
-            }
-            break;
+typedef struct jswrpool
+{
+    jswrchunk_t * chunks;
+    unsigned int chunk_count;
+    unsigned int next;
+    const jswrstate_t * st;
+    const jswrwriter_obj * jswr;
+#ifdef _WIN32
+    CRITICAL_SECTION lock;
+#else
+    pthread_mutex_t lock;
+#endif
+} jswrpool_t;
 
-            case JSWR_TOKEN_ARRAYOPEN:
-            is_array=0;
-            if (is_end && !jswr->setting_allowextradata)
-            {
-                error_type=JSWR_ERROR_UNEXPECTEDEXTRA;
-                free(level_types);
-                return error_type;
-            }
-            if (!prev_key)
-            {
-                if (level>0)
-                {
-                    if (level_types[level-1]==JSWR_LEVEL_ARRAY)
-                    {
-                        is_array=1;
-                        if (JSWR_DEBUGPRINT) printf("%d Array Opening in Array (%d)\n",i,level-1);
-                    }
-                }
-                if (jswrwriter_istokenitem(prev_type, 0) && !is_array)
-                {
-                    error_type=JSWR_ERROR_INVALBRACKET;
-                    free(level_types);
-                    return error_type;
-                }
-                jswrwriter_writetab(i,level,jswr);
-            }
-            prev_key=0;
-            level+=1;
-            level_types = realloc(level_types, level * sizeof(unsigned int));
-            level_types[level-1]=JSWR_LEVEL_ARRAY;
-            if (JSWR_DEBUGPRINT) printf("Array Opening (%d)\n",i);
-            jswrwriter_putc('[',jswr);
-            break;
+/*
+* Writes a chunk of root array items into its own string data, on a copy of the writer and the state just past the root's opening.
+* Nothing shared is written to, so chunks can be written on any thread.
+*/
+static void jswrwriter_writechunk(jswrchunk_t * chunk, const jswrstate_t * root_st, const jswrwriter_obj * jswr)
+{
+    jswrwriter_obj shadow;
+    jswrstate_t st;
+    jswrtok_t tok;
+    const unsigned char * tape;
+    unsigned int i;
+    int error_type;
+    shadow=*jswr;
+    shadow.wr_str=(char *) malloc(sizeof(char) * JSWR_STR_MINSIZE);
+    shadow.wr_str[0]='\0';
+    shadow.wr_strsize=0;
+    shadow.wr_strcap=JSWR_STR_MINSIZE;
+    shadow.wr_indent=NULL; //Its own, since writing can grow it.
+    shadow.wr_indentsize=0;
+    shadow.wr_sink=NULL;
+    shadow.wr_measured=0;
+    st=*root_st;
+    st.need_comma=chunk->need_comma;
+    st.prev_break=chunk->prev_break;
+    error_type=JSWR_SUCCESS;
+    tape=chunk->tape;
+    for (i=0;i<chunk->count && error_type==JSWR_SUCCESS;i++)
+    {
+        tape=jswrwriter_tape_read(tape, &tok);
+        error_type=jswrwriter_emit(&tok, &st, &shadow);
+        if (tok.tok_type==JSWR_TOKEN_ARRAYOPEN && shadow.setting_compact>0 && shadow.setting_uselines)
+            st.compact=(unsigned char) jswrwriter_iscompact(tape, chunk->count-i-1, shadow.setting_compact);
+    }
+    free(shadow.wr_indent);
+    chunk->str=shadow.wr_str;
+    chunk->str_size=shadow.wr_strsize;
+    if (shadow.wr_measure) //Only counted, so it's joined as that many chars that are never looked at.
+        chunk->str_size=shadow.wr_measured;
+    chunk->error=error_type;
+}
 
-            case JSWR_TOKEN_ARRAYCLOSE:
-            if (prev_key)
-            {
-                error_type=JSWR_ERROR_UNCLOSEDKEY;
-                free(level_types);
-                return error_type;
-            }
-            if (level_types[level-1]==JSWR_LEVEL_ARRAY)
-            {
-            level-=1;
-            if (level<0)
-            {
-                level=0;
-                is_error=1;
-                error_type=JSWR_ERROR_UNEXPECTEDBRACKET;
-                free(level_types);
-                return error_type;
-            }
-            level_types = realloc(level_types, level * sizeof(unsigned int));
-            jswrwriter_writetab(i,level,jswr);
-            jswrwriter_putc(']',jswr);
-            if (level>0)
-            {
-                if (JSWR_DEBUGPRINT) printf("Array Closing... ");
-                switch(level_types[level-1])
-                {
-                case JSWR_LEVEL_ARRAY:
-                    if (JSWR_DEBUGPRINT) printf("Back to Array? (%d)",i,level-1);
-                    if (jswr->wr_size > i+1)
-                    {
-                        if (jswrwriter_istokenitem(jswr->wr_token[i+1].tok_type, 1))
-                        {
-                            if (JSWR_DEBUGPRINT) printf(",");
-                            jswrwriter_putc(',',jswr);
-                            if (temp_beauty==0) jswrwriter_putc(' ',jswr);
-                        }
-                    }
-                    if (JSWR_DEBUGPRINT) printf("\n");
-                break;
-                case JSWR_LEVEL_OBJ:
-                    if (JSWR_DEBUGPRINT) printf("Back to Object? (%d)",i,level-1);
-                    if (jswr->wr_size > i+1)
-                    {
-                        if (jswrwriter_istokenitem(jswr->wr_token[i+1].tok_type, 1))
-                        {
-                            if (JSWR_DEBUGPRINT) printf(",");
-                            jswrwriter_putc(',',jswr);
-                            if (temp_beauty==0) jswrwriter_putc(' ',jswr);
-                        }
-                    }
-                    if (JSWR_DEBUGPRINT) printf("\n");
-                    break;
-                default:
-                    if (JSWR_DEBUGPRINT) printf("\n");
-                    break;
-                }
-            }
-            if (level==0)
+static void jswrwriter_poolwork(jswrpool_t * pool) //Takes the next chunk until there are none left, so faster threads end up taking more.
+{
+    unsigned int index;
+    for (;;)
+    {
+#ifdef _WIN32
+        EnterCriticalSection(&pool->lock);
+        index=pool->next++;
+        LeaveCriticalSection(&pool->lock);
+#else
+        pthread_mutex_lock(&pool->lock);
+        index=pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+#endif
+        if (index>=pool->chunk_count)
+            return;
+        jswrwriter_writechunk(&pool->chunks[index], pool->st, pool->jswr);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI jswrwriter_poolthread(LPVOID pool)
+{
+    jswrwriter_poolwork((jswrpool_t *) pool);
+    return 0;
+}
+#else
+static void * jswrwriter_poolthread(void * pool)
+{
+    jswrwriter_poolwork((jswrpool_t *) pool);
+    return NULL;
+}
+#endif
+
+static void jswrwriter_lastcommand(jswrtok_t * tok) //Swaps a fragment for the last command it writes, which is what the state is left after, with the break it leaves.
+{
+    const unsigned char * tape;
+    unsigned int i,beauty_break;
+    while (tok->tok_type==JSWR_TOKEN_FRAGMENT && tok->str!=NULL)
+    {
+        beauty_break=tok->str_size==1 && tok->beauty_break;
+        tape=tok->str;
+        for (i=tok->str_size;i>0;i--)
+            tape=jswrwriter_tape_read(tape, tok);
+        if (beauty_break)
+            tok->beauty_break=1;
+    }
+    if (tok->tok_type==JSWR_TOKEN_CACHED)
+        tok->beauty_break=(unsigned int) tok->num_int;
+    else if ((tok->tok_type>=JSWR_TOKEN_INTARRAY && tok->tok_type<=JSWR_TOKEN_STRINGARRAY) || tok->tok_type==JSWR_TOKEN_STRUCT)
+        tok->beauty_break=0; //Written whole, so they leave no break behind, like a closing bracket without one.
+}
+
+/*
+* Splits the root array's items into chunks, by how much tape they take.
+* Gives back how many chunks there are, or 0 if the root array doesn't close cleanly (left for the serial walk to report).
+*/
+static unsigned int jswrwriter_splitchunks(const unsigned char * tape, const unsigned int left, jswrchunk_t * chunks, const unsigned int max_chunks, const unsigned int chunk_bytes, const unsigned char first_break, jswrtok_t * close_tok)
+{
+    unsigned int i,chunk_count,level;
+    const unsigned char * next;
+    jswrtok_t prev_tok;
+    unsigned char prev_break,prev_special;
+    chunk_count=0;
+    level=0;
+    prev_break=first_break;
+    prev_special=0;
+    for (i=0;i<left;i++)
+    {
+        next=jswrwriter_tape_read(tape, close_tok);
+        if (level==0)
+        {
+            if (close_tok->tok_type==JSWR_TOKEN_ARRAYCLOSE)
+                return chunk_count;
+            if (!jswrwriter_istokenitem(close_tok->tok_type,1))
+                return 0;
+            if (chunk_count==0 || (chunk_count<max_chunks && (unsigned int) (tape-chunks[chunk_count-1].tape)>=chunk_bytes))
             {
-                if (JSWR_DEBUGPRINT) printf("Array Closing... Back to Root Level (%d)",i);
-                if (jswr->setting_allowextradata)
+                if (chunk_count>0 && prev_special)
                 {
-                if (jswr->wr_size > i+1)
-                {
-                    if (jswrwriter_istokenitem(jswr->wr_token[i+1].tok_type,1))
-                    {
-                        if (JSWR_DEBUGPRINT) printf(",");
-                        jswrwriter_putc(',',jswr);
-                        if (temp_beauty==0) jswrwriter_putc(' ',jswr);
-                    }
-                }
+                    jswrwriter_lastcommand(&prev_tok);
+                    prev_break=(unsigned char) prev_tok.beauty_break;
                 }
-                else
-                    is_end=1;
-                if (JSWR_DEBUGPRINT) printf("\n");
+                chunks[chunk_count].tape=tape;
+                chunks[chunk_count].count=0;
+                chunks[chunk_count].need_comma=chunk_count>0;
+                chunks[chunk_count].prev_break=prev_break;
+                chunks[chunk_count].str=NULL;
+                chunk_count++;
             }
+        }
+        if (close_tok->tok_type==JSWR_TOKEN_OBJOPEN || close_tok->tok_type==JSWR_TOKEN_ARRAYOPEN)
+            level++;
+        else if (close_tok->tok_type==JSWR_TOKEN_OBJCLOSE || close_tok->tok_type==JSWR_TOKEN_ARRAYCLOSE)
+            level--;
+        chunks[chunk_count-1].count++;
+        prev_break=(unsigned char) close_tok->beauty_break;
+        prev_special=close_tok->tok_type==JSWR_TOKEN_FRAGMENT || close_tok->tok_type==JSWR_TOKEN_CACHED
+            || (close_tok->tok_type>=JSWR_TOKEN_INTARRAY && close_tok->tok_type<=JSWR_TOKEN_STRINGARRAY) || close_tok->tok_type==JSWR_TOKEN_STRUCT;
+        if (prev_special)
+            prev_tok=*close_tok;
+        tape=next;
+    }
+    return 0;
+}
+
+/*
+* Writes the items of a root array on several threads, right after its opening has been written.
+* The chunks are joined in order (or handed to the output sink), leaving tape and index at the root's closing.
+* If it can't be done, or a chunk has an error, nothing is changed, and the serial walk carries on as usual.
+*/
+static void jswrwriter_parse_threaded(const unsigned char ** tape, unsigned int * index, jswrstate_t * st, jswrwriter_obj * jswr)
+{
+    jswrpool_t pool;
+    jswrchunk_t * chunks;
+    jswrtok_t last_tok;
+    unsigned int i,chunk_count,max_chunks,thread_count,left;
+    int failed;
+#ifdef _WIN32
+    HANDLE * threads;
+#else
+    pthread_t * threads;
+#endif
+    if (jswr->wr_tapesize<JSWR_THREAD_MINSIZE)
+        return;
+    left=jswr->wr_size-*index-1;
+    max_chunks=jswr->setting_threads*8; //Plenty more chunks than threads, to even out items of different sizes.
+    chunks=(jswrchunk_t *) malloc(sizeof(jswrchunk_t) * max_chunks);
+    chunk_count=jswrwriter_splitchunks(*tape, left, chunks, max_chunks, (jswr->wr_tapesize/max_chunks)+1, st->prev_break, &last_tok);
+    if (chunk_count<2)
+    {
+        free(chunks);
+        return;
+    }
+    pool.chunks=chunks;
+    pool.chunk_count=chunk_count;
+    pool.next=0;
+    pool.st=st;
+    pool.jswr=jswr;
+    thread_count=jswr->setting_threads-1;
+    if (thread_count>chunk_count-1)
+        thread_count=chunk_count-1;
+#ifdef _WIN32
+    InitializeCriticalSection(&pool.lock);
+    threads=(HANDLE *) malloc(sizeof(HANDLE) * thread_count);
+    for (i=0;i<thread_count;i++)
+        threads[i]=CreateThread(NULL, 0, jswrwriter_poolthread, &pool, 0, NULL);
+    jswrwriter_poolwork(&pool);
+    for (i=0;i<thread_count;i++)
+    {
+        if (threads[i]!=NULL)
+        {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        }
+    }
+    DeleteCriticalSection(&pool.lock);
+#else
+    pthread_mutex_init(&pool.lock, NULL);
+    threads=(pthread_t *) malloc(sizeof(pthread_t) * thread_count);
+    for (i=0;i<thread_count;i++)
+    {
+        if (pthread_create(&threads[i], NULL, jswrwriter_poolthread, &pool)!=0)
             break;
+    }
+    thread_count=i; //Whichever threads couldn't start, the rest (and this one) pick up their chunks.
+    jswrwriter_poolwork(&pool);
+    for (i=0;i<thread_count;i++)
+        pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&pool.lock);
+#endif
+    free(threads);
+    failed=0;
+    for (i=0;i<chunk_count;i++)
+    {
+        if (chunks[i].error!=JSWR_SUCCESS)
+            failed=1;
+    }
+    for (i=0;i<chunk_count;i++)
+    {
+        if (!failed)
+        {
+            if (jswr->wr_sink!=NULL) //Handed over as they are, rather than copied into the string data first.
+            {
+                jswrwriter_flush(jswr);
+                if (jswr->wr_sink(jswr->wr_sinkdata, chunks[i].str, chunks[i].str_size)!=chunks[i].str_size && jswr->wr_error==JSWR_SUCCESS)
+                    jswr->wr_error=JSWR_ERROR_WRITEFAIL;
             }
             else
+                jswrwriter_putn(chunks[i].str, chunks[i].str_size, jswr);
+            st->pos+=chunks[i].count;
+            *index+=chunks[i].count;
+            while (chunks[i].count>0)
             {
-                is_error=1;
-                error_type=JSWR_ERROR_MISMATCH;
-                if (level<=0)
-                    error_type=JSWR_ERROR_UNEXPECTEDBRACKET;
-                free(level_types);
-                return error_type;
+                *tape=jswrwriter_tape_read(*tape, &last_tok);
+                chunks[i].count--;
             }
         }
-        prev_type=jswr->wr_token[i].tok_type;
-        if (is_end)
-            break;
-        i++;
+        free(chunks[i].str);
+    }
+    free(chunks);
+    if (failed)
+        return;
+    jswrwriter_lastcommand(&last_tok);
+    st->need_comma=1;
+    st->prev_type=last_tok.tok_type;
+    st->prev_break=(unsigned char) last_tok.beauty_break;
+}
+#endif
+
+JSWR_API int jswrwriter_parse(jswrwriter_obj * jswr)
+{
+    unsigned int i;
+    int error_type;
+    jswrstate_t * st;
+    const unsigned char * tape;
+    jswrtok_t tok;
+    if (jswr->setting_validate)
+    {
+        if (jswr->wr_checkerror!=JSWR_SUCCESS) //Already found while generating, so there's no need to write anything.
+            return jswr->wr_checkerror;
+        if (jswr->wr_checkstate.level>0)
+            return JSWR_ERROR_EXPECTEDBRACKET;
     }
-    if (level>0)
+    st=&jswr->wr_state; //The writer's own state, shared with streaming.
+    jswrwriter_initstate(st);
+    st->checked=jswr->setting_validate;
+    if (!jswr->wr_measure) //Measuring leaves what's already written alone.
+        jswrwriter_clearstr(jswr);
+    jswr->wr_error=JSWR_SUCCESS;
+    error_type=JSWR_SUCCESS;
+    i=0;
+    tape=jswr->wr_tape;
+    while (i<jswr->wr_size && !st->is_end && error_type==JSWR_SUCCESS)
     {
-        is_error=1;
-        error_type=JSWR_ERROR_EXPECTEDBRACKET;
+        tape=jswrwriter_tape_read(tape, &tok);
+        error_type=jswrwriter_emit(&tok, st, jswr);
+        if (tok.tok_type==JSWR_TOKEN_ARRAYOPEN && jswr->setting_compact>0 && jswr->setting_uselines)
+            st->compact=(unsigned char) jswrwriter_iscompact(tape, jswr->wr_size-i-1, jswr->setting_compact);
+#ifdef JSWR_THREADS
+        if (i==0 && tok.tok_type==JSWR_TOKEN_ARRAYOPEN && error_type==JSWR_SUCCESS && !st->compact && jswr->setting_threads>1)
+            jswrwriter_parse_threaded(&tape, &i, st, jswr);
+#endif
+        if (jswr->wr_sink!=NULL && jswr->wr_strsize>=jswr->setting_chunksize)
+            jswrwriter_flush(jswr);
+        i++;
     }
-    free(level_types);
+    if (error_type==JSWR_SUCCESS && st->level>0)
+        error_type=JSWR_ERROR_EXPECTEDBRACKET;
+    jswrwriter_flush(jswr);
+    if (error_type==JSWR_SUCCESS)
+        error_type=jswr->wr_error;
+    return error_type;
+}
+
+/*
+* Parses with everything written only counted, through the same code as writing, so the size is always exact.
+* Strings are still scanned for escapes and numbers still formatted (ints only have their digits counted), but nothing is copied.
+* The string data is never touched, and the state and error the parse leaves are put back, so the last parse's JSON is still there after.
+*/
+JSWR_API int jswrwriter_measure(unsigned int * size, jswrwriter_obj * jswr)
+{
+    jswrsink_fn old_sink;
+    jswrstate_t old_state;
+    int old_error;
+    int error_type;
+    old_sink=jswr->wr_sink;
+    old_state=jswr->wr_state;
+    old_error=jswr->wr_error;
+    jswr->wr_sink=NULL; //Nothing gets to it anyway.
+    jswr->wr_measure=1;
+    jswr->wr_measured=0;
+    error_type=jswrwriter_parse(jswr);
+    jswr->wr_measure=0;
+    jswr->wr_sink=old_sink;
+    jswr->wr_state=old_state;
+    jswr->wr_error=old_error;
+    *size=jswr->wr_measured;
     return error_type;
 }
 
@@ -985,6 +4429,27 @@ JSWR_API int jswrwriter_filewrite(const char * filename, jswrwriter_obj * jswr)
     return JSWR_SUCCESS;
 }
 
+JSWR_API int jswrwriter_fileparse(const char * filename, jswrwriter_obj * jswr)
+{
+    FILE * output_file;
+    jswrsink_fn old_sink;
+    void * old_sinkdata;
+    int error_type;
+
+    output_file=fopen(filename,"w");
+    if (output_file==NULL)
+        return JSWR_ERROR_WRITEFAIL;
+
+    old_sink=jswr->wr_sink;
+    old_sinkdata=jswr->wr_sinkdata;
+    jswrwriter_set_sink_file(output_file, jswr);
+    error_type=jswrwriter_parse(jswr);
+    jswrwriter_set_sink_callback(old_sink, old_sinkdata, jswr);
+    if (fclose(output_file)!=0 && error_type==JSWR_SUCCESS)
+        error_type=JSWR_ERROR_WRITEFAIL;
+    return error_type;
+}
+
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,422 @@
+/*
+* MIT License
+*
+* Copyright (c) 2023 Zachary Tabikh
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+//JSMR Writer C++ front end (C++17)
+
+#ifndef JSWR_HPP
+#define JSWR_HPP
+
+#include <cstddef>
+#include <iterator>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "jswrwriter.h"
+
+namespace jswr
+{
+
+namespace detail
+{
+
+/*
+* The same escapes the writer makes with its default settings, '/' and non-ASCII bytes are left as they are.
+*/
+constexpr char escape_char(const unsigned char c)
+{
+    switch (c)
+    {
+        case '"': return '"';
+        case '\\': return '\\';
+        case '\b': return 'b';
+        case '\t': return 't';
+        case '\n': return 'n';
+        case '\f': return 'f';
+        case '\r': return 'r';
+        default: break;
+    }
+    if (c<0x20)
+        return 'u';
+    return 0;
+}
+
+template<typename T>
+inline constexpr bool always_false=false;
+
+template<typename T, typename = void>
+struct is_range : std::false_type {};
+
+template<typename T>
+struct is_range<T, std::void_t<decltype(std::begin(std::declval<const T &>())), decltype(std::end(std::declval<const T &>()))>> : std::true_type {};
+
+template<typename T, typename = void>
+struct contiguous_item { using type=void; };
+
+template<typename T>
+struct contiguous_item<T, std::void_t<decltype(std::data(std::declval<const T &>())), decltype(std::size(std::declval<const T &>()))>>
+{
+    using type=std::remove_cv_t<std::remove_pointer_t<decltype(std::data(std::declval<const T &>()))>>;
+};
+
+template<typename T, typename = void>
+struct is_map : std::false_type {};
+
+template<typename T>
+struct is_map<T, std::void_t<typename T::key_type, typename T::mapped_type>> : std::is_convertible<const typename T::key_type &, std::string_view> {};
+
+} //namespace detail
+
+/**
+* (JSWR Writer): A key escaped at compile time, quotes and ": " included. Keys are generated without being copied, so keep them around (static constexpr) until the writer is parsed.
+* Temporary keys are turned away when compiling.
+*/
+template<std::size_t N>
+class key
+{
+public:
+    constexpr key(const char (&str)[N]) : data_{}, size_(0), escaped_size_(0)
+    {
+        std::size_t a=0,size=0,pos=0; //C++17 constexpr needs them set up front.
+        unsigned char c=0;
+        while (size<N-1 && str[size]!='\0') //'\0' ends it, like any other string.
+            size++;
+        for (a=0;a<size;a++)
+            data_[a]=str[a];
+        pos=size;
+        data_[pos++]='"';
+        for (a=0;a<size;a++)
+        {
+            c=(unsigned char) str[a];
+            if (detail::escape_char(c)==0)
+                data_[pos++]=str[a];
+            else if (detail::escape_char(c)=='u')
+            {
+                data_[pos++]='\\';
+                data_[pos++]='u';
+                data_[pos++]='0';
+                data_[pos++]='0';
+                data_[pos++]="0123456789abcdef"[c>>4];
+                data_[pos++]="0123456789abcdef"[c & 0xF];
+            }
+            else
+            {
+                data_[pos++]='\\';
+                data_[pos++]=detail::escape_char(c);
+            }
+        }
+        data_[pos++]='"';
+        data_[pos++]=':';
+        data_[pos++]=' ';
+        size_=(unsigned int) size;
+        escaped_size_=(unsigned int) (pos-size);
+    }
+
+    constexpr const char * data() const { return data_; }
+    constexpr unsigned int size() const { return size_; }
+    constexpr unsigned int escaped_size() const { return escaped_size_; }
+    constexpr std::string_view name() const { return std::string_view(data_, size_); }
+    constexpr std::string_view escaped() const { return std::string_view(data_+size_, escaped_size_); }
+
+private:
+    char data_[(N-1)*7+4]; //The key, then its escaped form right after it.
+    unsigned int size_;
+    unsigned int escaped_size_;
+};
+
+template<std::size_t N>
+key(const char (&)[N]) -> key<N>;
+
+/**
+* (JSWR Writer): Closes an object or array when it goes out of scope. Given by writer::object() and writer::array().
+*/
+class scope
+{
+public:
+    scope(scope && other) noexcept : jswr_(other.jswr_), is_array_(other.is_array_) { other.jswr_=nullptr; }
+    scope(const scope &)=delete;
+    scope & operator=(const scope &)=delete;
+    scope & operator=(scope &&)=delete;
+    ~scope() { close(); }
+
+    /**
+    * (JSWR Writer): Closes it early. Does nothing if it was already closed.
+    */
+    void close()
+    {
+        if (jswr_==nullptr)
+            return;
+        if (is_array_)
+            jswrwriter_gen_array_close(jswr_);
+        else
+            jswrwriter_gen_object_close(jswr_);
+        jswr_=nullptr;
+    }
+
+private:
+    friend class writer;
+    scope(jswrwriter_obj * jswr, const bool is_array) : jswr_(jswr), is_array_(is_array) {}
+
+    jswrwriter_obj * jswr_;
+    bool is_array_;
+};
+
+/**
+* (JSWR Writer): Owns a jswrwriter_obj, set up and freed along with it. Can be moved, but not copied.
+*/
+class writer
+{
+public:
+    writer() : jswr_(new jswrwriter_obj) { jswrwriter_init(jswr_); }
+    writer(writer && other) noexcept : jswr_(other.jswr_) { other.jswr_=nullptr; }
+    writer(const writer &)=delete;
+    writer & operator=(const writer &)=delete;
+    ~writer() { release(); }
+
+    writer & operator=(writer && other) noexcept
+    {
+        if (this!=&other)
+        {
+            release();
+            jswr_=other.jswr_;
+            other.jswr_=nullptr;
+        }
+        return *this;
+    }
+
+    /**
+    * (JSWR Writer): The writer underneath, for the settings and anything else from the C functions.
+    */
+    jswrwriter_obj * get() const noexcept { return jswr_; }
+
+    /**
+    * (JSWR Writer): Writes the generated JSON, giving back JSWR_SUCCESS or the error.
+    */
+    int parse() { return jswrwriter_parse(jswr_); }
+
+    /**
+    * (JSWR Writer): The written JSON.
+    */
+    std::string_view str() const { return std::string_view(jswr_->wr_str, jswr_->wr_strsize); }
+
+    template<std::size_t N>
+    writer & key(const jswr::key<N> & k)
+    {
+        jswrwriter_gen_key_ref(k.data(), k.size(), k.escaped_size(), jswr_);
+        return *this;
+    }
+
+    template<std::size_t N>
+    writer & key(const jswr::key<N> &&)=delete; //Keys aren't copied, so a temporary one would be gone before it's parsed.
+
+    writer & key(const std::string_view k)
+    {
+        jswrwriter_gen_string(k.data(), (unsigned int) k.size(), jswr_);
+        return *this;
+    }
+
+    /**
+    * (JSWR Writer): Generates an interned key by its handle (see jswrwriter_keys_add()).
+    */
+    writer & key_id(const unsigned int handle)
+    {
+        jswrwriter_gen_key(handle, jswr_);
+        return *this;
+    }
+
+    /**
+    * (JSWR Writer): Generates a value with whichever command fits its type best. Ranges of ints and doubles in one block become bulk arrays,
+    * maps with string keys become objects, and other ranges become arrays of their items.
+    */
+    template<typename T>
+    writer & value(const T & v)
+    {
+        using U=std::remove_cv_t<T>;
+        using item_t=typename detail::contiguous_item<U>::type;
+        if constexpr (std::is_same_v<U, bool>)
+            jswrwriter_gen_bool(v, jswr_);
+        else if constexpr (std::is_same_v<U, std::nullptr_t>)
+            jswrwriter_gen_null(jswr_);
+        else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>)
+        {
+            if constexpr (sizeof(U)<=sizeof(int))
+                jswrwriter_gen_int(v, jswr_);
+            else
+                jswrwriter_gen_int64((jswr_i64) v, jswr_);
+        }
+        else if constexpr (std::is_integral_v<U>)
+        {
+            if constexpr (sizeof(U)<=sizeof(unsigned int))
+                jswrwriter_gen_uint(v, jswr_);
+            else
+                jswrwriter_gen_uint64((jswr_u64) v, jswr_);
+        }
+        else if constexpr (std::is_same_v<U, float>)
+            jswrwriter_gen_float(v, jswr_);
+        else if constexpr (std::is_floating_point_v<U>)
+            jswrwriter_gen_double((double) v, jswr_);
+        else if constexpr (std::is_convertible_v<const U &, std::string_view>)
+        {
+            const std::string_view s=v;
+            jswrwriter_gen_string(s.data(), (unsigned int) s.size(), jswr_);
+        }
+        else if constexpr (detail::is_map<U>::value)
+        {
+            jswrwriter_gen_object_open(jswr_);
+            for (const auto & item : v)
+            {
+                key(std::string_view(item.first));
+                value(item.second);
+            }
+            jswrwriter_gen_object_close(jswr_);
+        }
+        else if constexpr (std::is_same_v<item_t, int>)
+            jswrwriter_gen_int_array(std::data(v), (unsigned int) std::size(v), 1, jswr_); //One to a line (or all on one when compact), like items generated on their own.
+        else if constexpr (std::is_same_v<item_t, double>)
+            jswrwriter_gen_double_array(std::data(v), (unsigned int) std::size(v), 1, jswr_);
+        else if constexpr (detail::is_range<U>::value)
+        {
+            jswrwriter_gen_array_open(jswr_);
+            for (const auto & item : v)
+                value(item);
+            jswrwriter_gen_array_close(jswr_);
+        }
+        else
+            static_assert(detail::always_false<U>, "jswr::writer::value(): no command for this type");
+        return *this;
+    }
+
+    /**
+    * (JSWR Writer): Generates a key and its value.
+    */
+    template<std::size_t N, typename T>
+    writer & member(const jswr::key<N> & k, const T & v)
+    {
+        key(k);
+        return value(v);
+    }
+
+    template<std::size_t N, typename T>
+    writer & member(const jswr::key<N> &&, const T &)=delete;
+
+    template<typename T>
+    writer & member(const std::string_view k, const T & v)
+    {
+        key(k);
+        return value(v);
+    }
+
+    /**
+    * (JSWR Writer): Generates a string without copying it, so it has to stay around until the writer is parsed.
+    */
+    writer & string_ref(const std::string_view s)
+    {
+        jswrwriter_gen_string_ref(s.data(), (unsigned int) s.size(), jswr_);
+        return *this;
+    }
+
+    writer & raw(const std::string_view s)
+    {
+        jswrwriter_gen_raw(s.data(), (unsigned int) s.size(), jswr_);
+        return *this;
+    }
+
+    writer & null()
+    {
+        jswrwriter_gen_null(jswr_);
+        return *this;
+    }
+
+    writer & beautify_break()
+    {
+        jswrwriter_gen_beautify_break(jswr_);
+        return *this;
+    }
+
+    /**
+    * (JSWR Writer): Opens an object, closed when the scope given back goes away.
+    */
+    [[nodiscard]] scope object()
+    {
+        jswrwriter_gen_object_open(jswr_);
+        return scope(jswr_, false);
+    }
+
+    template<std::size_t N>
+    [[nodiscard]] scope object(const jswr::key<N> & k)
+    {
+        key(k);
+        return object();
+    }
+
+    template<std::size_t N>
+    scope object(const jswr::key<N> &&)=delete;
+
+    [[nodiscard]] scope object(const std::string_view k)
+    {
+        key(k);
+        return object();
+    }
+
+    /**
+    * (JSWR Writer): Opens an array, closed when the scope given back goes away.
+    */
+    [[nodiscard]] scope array()
+    {
+        jswrwriter_gen_array_open(jswr_);
+        return scope(jswr_, true);
+    }
+
+    template<std::size_t N>
+    [[nodiscard]] scope array(const jswr::key<N> & k)
+    {
+        key(k);
+        return array();
+    }
+
+    template<std::size_t N>
+    scope array(const jswr::key<N> &&)=delete;
+
+    [[nodiscard]] scope array(const std::string_view k)
+    {
+        key(k);
+        return array();
+    }
+
+private:
+    void release()
+    {
+        if (jswr_==nullptr)
+            return;
+        jswrwriter_free(jswr_);
+        delete jswr_;
+        jswr_=nullptr;
+    }
+
+    jswrwriter_obj * jswr_; //Kept apart from the writer, so moving it is only a pointer.
+};
+
+} //namespace jswr
+
+#endif
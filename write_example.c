@@ -27,11 +27,25 @@
 #include <string.h>
 #include "jswrwriter.h"
 
+typedef struct example_point
+{
+    int x;
+    int y;
+} example_point_t;
+
+#define EXAMPLE_POINT_FIELDS(X, T) \
+    X(T, x, JSWR_FIELD_INT) \
+    X(T, y, JSWR_FIELD_INT)
+
+JSWR_STRUCT(example_point_desc, example_point_t, EXAMPLE_POINT_FIELDS);
+
 int main()
 {
     jswrwriter_obj myjswr;
     int error;
 	int i;
+	int bulk_ints[3]={1, 2, 3};
+	example_point_t point;
 
     printf("JSWR!\n");
     jswrwriter_init(&myjswr);
@@ -118,6 +132,15 @@ int main()
 	//jswrwriter_gen_beautify_break(&myjswr);
 	jswrwriter_gen_array_close(&myjswr);
 	jswrwriter_gen_object_close(&myjswr);
+
+	//Bulk arrays and structs after a break
+	point.x=4;
+	point.y=-5;
+	jswrwriter_gen_beautify_break(&myjswr);
+	jswrwriter_gen_int_array(bulk_ints, 3, 1, &myjswr);
+	jswrwriter_gen_beautify_break(&myjswr);
+	jswrwriter_gen_struct(&point, &example_point_desc, &myjswr);
+	jswrwriter_gen_int(7, &myjswr); //Demonstrating there's no bug, the commas before it don't get a trailing space.
     jswrwriter_gen_array_close(&myjswr);
     jswrwriter_debugprint(&myjswr);
     error=jswrwriter_parse(&myjswr);
@@ -137,6 +160,12 @@ int main()
         case JSWR_ERROR_TOKENOUTSIDE: printf("Writing Outside of Object or Array"); break;
         case JSWR_ERROR_UNEXPECTEDEXTRA: printf("Unexpected Extra Data"); break;
         case JSWR_ERROR_WRITEFAIL: printf("File Writing Failure"); break;
+        case JSWR_ERROR_BADUTF8: printf("Invalid UTF-8 String"); break;
+        case JSWR_ERROR_NONFINITE: printf("Non-Finite Number"); break;
+        case JSWR_ERROR_TOODEEP: printf("Nested Too Deep"); break;
+        case JSWR_ERROR_BADRAW: printf("Bad Raw JSON"); break;
+        case JSWR_ERROR_BADKEY: printf("Bad Key Handle"); break;
+        case JSWR_ERROR_TOOLARGE: printf("Bulk Array Too Large"); break;
         default: printf("IDK (%d)\n",error); break;
         }
     }